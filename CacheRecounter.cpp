@@ -0,0 +1,11 @@
+#include "CacheRecounter.h"
+#include "DetectionCache.h"
+
+QVector<int> CacheRecounter::run(const QString& filename) {
+	DetectionCache cache;
+	QVector<int> carsCount(_segments.size());
+	if (cache.open(filename))
+		carsCount = cache.recount(_segments);
+	emit finished(filename, carsCount);
+	return carsCount;
+}
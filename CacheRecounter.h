@@ -0,0 +1,26 @@
+#pragma once
+
+#include <QLineF>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+// Batch recount from a detection cache written by
+// DetectFilter::setDetectionCache, meant to live on a worker thread
+class CacheRecounter : public QObject {
+	Q_OBJECT
+public:
+	explicit CacheRecounter(QObject* parent = nullptr) :
+		QObject(parent)
+	{
+		// empty
+	}
+
+	Q_SLOT void setSegments(const QVector<QLineF>& segments) { _segments = segments; }
+	// Tracking and counting only, blocks until the whole cache is replayed
+	Q_SLOT QVector<int> run(const QString& filename);
+	Q_SIGNAL void finished(const QString& filename, const QVector<int>& carsCount);
+
+private:
+	QVector<QLineF> _segments;
+};
@@ -34,7 +34,16 @@ HEADERS += \
     GraphicsItemPolyline.h \
     ImageViewer.h \
     processing.h \
-    QtUtility.h
+    QtUtility.h \
+    ChunkedCounter.h \
+    VideoRecorder.h \
+    SnapshotWriter.h \
+    ParameterSweep.h \
+    ZoneMap.h \
+    DetectionCache.h \
+    TrajectoryStore.h \
+    Tracer.h \
+    CacheRecounter.h
 
 SOURCES += \
     main.cpp \
@@ -42,6 +51,15 @@ SOURCES += \
     GraphicsItemPolyline.cpp \
     ImageViewer.cpp \
     processing.cpp \
-    QtUtility.cpp
+    QtUtility.cpp \
+    ChunkedCounter.cpp \
+    VideoRecorder.cpp \
+    SnapshotWriter.cpp \
+    ParameterSweep.cpp \
+    ZoneMap.cpp \
+    DetectionCache.cpp \
+    TrajectoryStore.cpp \
+    Tracer.cpp \
+    CacheRecounter.cpp
 
 FORMS += mainwindow.ui
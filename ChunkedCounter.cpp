@@ -0,0 +1,159 @@
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+#include "ChunkedCounter.h"
+#include "processing.h"
+
+namespace {
+
+class ChunkTask : public QRunnable {
+public:
+	ChunkTask(const QString& filename, const QVector<QLineF>& segments, int begin, int end, int overlap, ChunkedCounter::ChunkResult& result) :
+		_filename(filename), _segments(segments), _begin(begin), _end(end), _overlap(overlap), _result(result)
+	{
+		// empty
+	}
+	void run() override {
+		_result = ChunkedCounter::countChunk(_filename, _segments, _begin, _end, _overlap);
+	}
+private:
+	QString _filename;
+	QVector<QLineF> _segments;
+	int _begin, _end, _overlap;
+	ChunkedCounter::ChunkResult& _result;
+};
+
+// FNV-1a of a thumbnail; decoding is deterministic, so the same frame
+// gives the same value in every chunk
+quint64 fingerprint(const cv::Mat& frame) {
+	cv::Mat thumbnail;
+	cv::resize(frame, thumbnail, cv::Size(32, 18), 0, 0, cv::INTER_AREA);
+	quint64 hash = 14695981039346656037ull;
+	for (int y = 0; y < thumbnail.rows; ++y) {
+		const uchar* p = thumbnail.ptr<uchar>(y);
+		for (size_t x = 0; x < thumbnail.cols * thumbnail.elemSize(); ++x)
+			hash = (hash ^ p[x]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+// Index of the sync point of `result` that is `sync`, -1 if there is none
+int findSyncPoint(const ChunkedCounter::ChunkResult& result, const ChunkedCounter::SyncPoint& sync) {
+	int found = -1;
+	for (int i = 0; i < result.syncPoints.size(); ++i) {
+		const ChunkedCounter::SyncPoint &candidate = result.syncPoints[i];
+		if (candidate.fingerprint == sync.fingerprint &&
+			(found < 0 || std::abs(candidate.frame - sync.frame) < std::abs(result.syncPoints[found].frame - sync.frame)))
+			found = i;
+	}
+	return found;
+}
+
+}
+
+ChunkedCounter::ChunkedCounter(QObject* parent) :
+	QObject(parent),
+	_chunks(QThread::idealThreadCount()),
+	_overlap(10 * 24)
+{
+	// empty
+}
+
+ChunkedCounter::ChunkResult ChunkedCounter::countChunk(const QString& filename, const QVector<QLineF>& segments, int begin, int end, int overlap) {
+	ChunkResult result;
+	result.begin = begin;
+	result.end = end;
+	result.carsCount.resize(segments.size());
+	cv::VideoCapture capture(filename.toStdString());
+	if (!capture.isOpened())
+		return result;
+
+	DayBatchPipeline pipeline;
+	DetectContext ctx;
+	ctx.segments = segments;
+	ctx.carsCount.resize(segments.size());
+	const int maxGap = ctx.params.maxFramesWithoutMatch;
+
+	// enough frames before begin to see a whole gap; the first decoded frame
+	// only primes the frame difference
+	int position = std::max(0, begin - maxGap - 1);
+	if (position > 0)
+		capture.set(cv::CAP_PROP_POS_FRAMES, position);
+	ctx.frameCount = position;
+	// nothing is tracked before the first frame of the file
+	int quietFrames = position == 0 ? maxGap : 0;
+	bool counting = false;
+
+	cv::Mat frame;
+	while (capture.read(frame)) {
+		int number = ctx.frameCount + 1;
+		if (quietFrames >= maxGap) {
+			if (counting && number >= end && number - end >= overlap)
+				break;
+			if (counting || number >= begin) {
+				counting = true;
+				result.syncPoints.push_back(SyncPoint{ number, fingerprint(frame), result.carsCount });
+			}
+		}
+		pipeline.run(ctx, frame);
+		if (ctx.frameCount > position + 1) {
+			bool detected = std::any_of(ctx.cars.begin(), ctx.cars.end(), [](const CarDescriptor& car) { return car.isMatchFound; });
+			quietFrames = detected ? 0 : quietFrames + 1;
+		}
+		if (counting)
+			for (auto &crossing : ctx.crossings)
+				++result.carsCount[crossing.segment];
+	}
+	return result;
+}
+
+QVector<int> ChunkedCounter::run(const QString& filename) {
+	QVector<int> carsCount(_segments.size());
+	int frames;
+	{
+		cv::VideoCapture capture(filename.toStdString());
+		if (!capture.isOpened()) {
+			emit finished(filename, carsCount);
+			return carsCount;
+		}
+		frames = (int)capture.get(cv::CAP_PROP_FRAME_COUNT);
+	}
+	// unknown length (stream-like containers), fall back to a sequential run
+	int chunks = 1;
+	if (frames > 0)
+		chunks = std::max(1, std::min(_chunks, frames / std::max(1, 2 * _overlap)));
+
+	QVector<ChunkResult> results(chunks);
+	QThreadPool pool;
+	pool.setMaxThreadCount(chunks);
+	for (int i = 0; i < chunks; ++i) {
+		int begin = (int)((qint64)frames * i / chunks);
+		// the reported frame count is an estimate, let the last chunk read to the end
+		int end = (i == chunks - 1) ? std::numeric_limits<int>::max() : (int)((qint64)frames * (i + 1) / chunks);
+		pool.start(new ChunkTask(filename, _segments, begin, end, _overlap, results[i]));
+	}
+	pool.waitForDone();
+
+	// each chunk counts up to where the next one starts counting
+	ChunkResult current = results[0];
+	for (int k = 1; k < chunks; ++k) {
+		const ChunkResult &next = results[k];
+		int j = next.syncPoints.isEmpty() ? -1 : findSyncPoint(current, next.syncPoints[0]);
+		if (j < 0) {
+			// no gap in the traffic both chunks saw, count them as one
+			current = countChunk(filename, _segments, current.begin, next.end, _overlap);
+			continue;
+		}
+		for (int i = 0; i < carsCount.size(); ++i)
+			carsCount[i] += current.syncPoints[j].carsCount[i];
+		current = next;
+	}
+	for (int i = 0; i < carsCount.size(); ++i)
+		carsCount[i] += current.carsCount[i];
+	emit finished(filename, carsCount);
+	return carsCount;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <QLineF>
+#include <QObject>
+#include <QString>
+#include <QVector>
+
+// Offline counting of a recorded file split into time chunks processed
+// concurrently, with totals equal to a sequential run.
+//
+// Chunks are stitched at sync frames: frames preceded by
+// maxFramesWithoutMatch frames without any detection. Every track has
+// expired there, in a sequential run as well as in a chunk that started
+// decoding shortly before, and the detector only depends on the frame and
+// its predecessor, so from a sync frame on both runs are identical. Each
+// chunk starts counting at its first sync frame and keeps decoding past its
+// end until a sync frame at least `overlap` frames later, recording the
+// counts at every sync frame on the way. Seeking is only a hint: sync
+// frames are matched between chunks by a fingerprint of the decoded image.
+// Where no common sync frame exists (traffic without gaps), the two chunks
+// are counted again as one.
+class ChunkedCounter : public QObject {
+	Q_OBJECT
+public:
+	struct SyncPoint {
+		int frame;                  // as reported by the decoder, breaks fingerprint ties
+		quint64 fingerprint;
+		QVector<int> carsCount;     // from the first sync point of the chunk up to this frame
+	};
+
+	struct ChunkResult {
+		int begin, end;
+		QVector<SyncPoint> syncPoints;
+		QVector<int> carsCount;     // from the first sync point to where the chunk stopped
+	};
+
+	explicit ChunkedCounter(QObject* parent = nullptr);
+
+	Q_SLOT void setSegments(const QVector<QLineF>& segments) { _segments = segments; }
+	void setChunks(int chunks) { _chunks = chunks; }
+	void setOverlap(int frames) { _overlap = frames; }
+
+	// Blocks until the whole file is processed
+	Q_SLOT QVector<int> run(const QString& filename);
+	Q_SIGNAL void finished(const QString& filename, const QVector<int>& carsCount);
+
+	// Counts from the first sync frame at or after begin (1-based) to the first
+	// sync frame at least overlap frames after end
+	static ChunkResult countChunk(const QString& filename, const QVector<QLineF>& segments, int begin, int end, int overlap);
+
+private:
+	QVector<QLineF> _segments;
+	int _chunks;
+	int _overlap;
+};
@@ -0,0 +1,185 @@
+#include <cstring>
+
+#include "DetectionCache.h"
+
+static const quint32 cacheVersion = 2;
+
+// class DetectionCacheWriter
+
+DetectionCacheWriter::DetectionCacheWriter(const QString& filename) :
+	_file(filename),
+	_firstFrame(0),
+	_pendingFlags(0)
+{
+	if (!_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+		return;
+	CacheHeader header;
+	std::memcpy(header.magic, "CCDC", 4);
+	header.version = cacheVersion;
+	header.firstFrame = 0;
+	header.frames = 0;
+	header.indexOffset = 0;
+	_file.write((const char*)&header, sizeof(header));
+}
+
+DetectionCacheWriter::~DetectionCacheWriter() {
+	if (!isOpen())
+		return;
+	CacheHeader header;
+	std::memcpy(header.magic, "CCDC", 4);
+	header.version = cacheVersion;
+	header.firstFrame = _firstFrame;
+	header.frames = _index.size();
+	header.indexOffset = (quint64)_file.pos();
+	_file.write((const char*)_index.constData(), _index.size() * sizeof(CacheIndexEntry));
+	_file.seek(0);
+	_file.write((const char*)&header, sizeof(header));
+}
+
+void DetectionCacheWriter::write(int frame, const std::list<CarDescriptor>& cars) {
+	_buffer.clear();
+	for (auto &car : cars) {
+		const cv::Rect &r = car.boundingRect;
+		const cv::Point &center = car.centerPositions.back();
+		_buffer.push_back(CachedBlob{ r.x, r.y, r.width, r.height, center.x, center.y, (float)car.area, (qint32)car.contour.size() });
+	}
+	if (addEntry(frame, (quint32)_buffer.size(), 0))
+		_file.write((const char*)_buffer.data(), _buffer.size() * sizeof(CachedBlob));
+}
+
+void DetectionCacheWriter::skip(int frame) {
+	addEntry(frame, 0, CacheFrameSkipped);
+}
+
+bool DetectionCacheWriter::addEntry(int frame, quint32 count, quint32 flags) {
+	if (!isOpen())
+		return false;
+	if (_index.isEmpty())
+		_firstFrame = frame;
+	if (_firstFrame + _index.size() > frame)
+		return false;
+	// frames the pipeline never saw are not tracked on replay either
+	while (_firstFrame + _index.size() < frame) {
+		_index.push_back(CacheIndexEntry{ (quint64)_file.pos(), 0, CacheFrameSkipped | _pendingFlags });
+		_pendingFlags = 0;
+	}
+	_index.push_back(CacheIndexEntry{ (quint64)_file.pos(), count, flags | _pendingFlags });
+	_pendingFlags = 0;
+	return true;
+}
+
+
+
+// class DetectionCache
+
+bool DetectionCache::open(const QString& filename) {
+	close();
+	_file.setFileName(filename);
+	if (!_file.open(QIODevice::ReadOnly) || _file.size() < (qint64)sizeof(CacheHeader))
+		return false;
+	_data = _file.map(0, _file.size());
+	if (!_data)
+		return false;
+	_header = (const CacheHeader*)_data;
+	bool valid = std::memcmp(_header->magic, "CCDC", 4) == 0 &&
+		_header->version == cacheVersion &&
+		_header->frames >= 0 &&
+		_header->indexOffset >= sizeof(CacheHeader) &&
+		_header->indexOffset + (quint64)_header->frames * sizeof(CacheIndexEntry) <= (quint64)_file.size();
+	if (!valid) {
+		close();
+		return false;
+	}
+	_index = (const CacheIndexEntry*)(_data + _header->indexOffset);
+	// blob records lie between the header and the index, so blobs() can trust the entries
+	for (int i = 0; i < _header->frames; ++i) {
+		const CacheIndexEntry &entry = _index[i];
+		if (entry.offset < sizeof(CacheHeader) || entry.offset > _header->indexOffset ||
+			(quint64)entry.count * sizeof(CachedBlob) > _header->indexOffset - entry.offset) {
+			close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void DetectionCache::close() {
+	if (_data)
+		_file.unmap(const_cast<uchar*>(_data));
+	_file.close();
+	_data = nullptr;
+	_header = nullptr;
+	_index = nullptr;
+}
+
+const CachedBlob* DetectionCache::blobs(int frame, int& count) const {
+	int i = frame - _header->firstFrame;
+	if (i < 0 || i >= _header->frames) {
+		count = 0;
+		return nullptr;
+	}
+	count = (int)_index[i].count;
+	return (const CachedBlob*)(_data + _index[i].offset);
+}
+
+quint32 DetectionCache::flags(int frame) const {
+	int i = frame - _header->firstFrame;
+	return i < 0 || i >= _header->frames ? 0 : _index[i].flags;
+}
+
+QVector<int> DetectionCache::recount(const QVector<QLineF>& segments, const DetectParams& params) const {
+	ReplayPipeline pipeline;
+	DetectContext ctx;
+	ctx.params = params;
+	ctx.segments = segments;
+	ctx.carsCount.resize(segments.size());
+	ctx.cacheReader = this;
+	if (!isOpen())
+		return ctx.carsCount;
+	ctx.frameCount = firstFrame() - 1;
+	for (int i = 0; i < frames(); ++i) {
+		// same as DetectFilter::reset, counts stay
+		if (flags(ctx.frameCount + 1) & CacheFrameReset) {
+			ctx.cars.clear();
+			ctx.currentFrameCars.clear();
+			pipeline = ReplayPipeline();
+		}
+		pipeline.run(ctx, cv::Mat());
+	}
+	return ctx.carsCount;
+}
+
+
+
+// pipeline hooks
+
+void recordDetections(DetectContext& ctx) {
+	ctx.cacheWriter->write(ctx.frameCount, ctx.currentFrameCars);
+}
+
+void recordSkippedFrame(DetectContext& ctx) {
+	ctx.cacheWriter->skip(ctx.frameCount);
+}
+
+bool isCachedFrameSkipped(const DetectContext& ctx) {
+	return ctx.cacheReader && (ctx.cacheReader->flags(ctx.frameCount) & CacheFrameSkipped);
+}
+
+void loadDetections(DetectContext& ctx) {
+	ctx.currentFrameCars.clear();
+	if (!ctx.cacheReader)
+		return;
+	int count;
+	const CachedBlob* blobs = ctx.cacheReader->blobs(ctx.frameCount, count);
+	for (int i = 0; i < count; ++i) {
+		const CachedBlob &b = blobs[i];
+		// the hull is not stored, its rect and area are all tracking uses
+		int right = b.x + b.width - 1, bottom = b.y + b.height - 1;
+		CarDescriptor car(std::vector<cv::Point>{
+			cv::Point(b.x, b.y), cv::Point(right, b.y), cv::Point(right, bottom), cv::Point(b.x, bottom)
+		});
+		car.centerPositions.back() = cv::Point(b.centerX, b.centerY);
+		car.area = b.hullArea;
+		ctx.currentFrameCars.push_back(car);
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <QFile>
+#include <QLineF>
+#include <QString>
+#include <QVector>
+#include <list>
+
+#include "processing.h"
+
+// Sidecar file with the per-frame detections of a recording, so counts
+// for new segments can be recomputed by replaying tracking and counting
+// only, without decoding the video.
+//
+// Layout (little-endian, as written by the host):
+//   CacheHeader
+//   CachedBlob records, grouped by frame
+//   CacheIndexEntry per frame starting at firstFrame, at header.indexOffset
+
+#pragma pack(push, 1)
+struct CacheHeader {
+	char magic[4];              // "CCDC"
+	quint32 version;
+	qint32 firstFrame;
+	qint32 frames;
+	quint64 indexOffset;        // 0 while the file is being written
+};
+
+struct CacheIndexEntry {
+	quint64 offset;
+	quint32 count;
+	quint32 flags;              // CacheFrameFlags
+};
+
+struct CachedBlob {
+	qint32 x, y, width, height;     // bounding rect, tracking space
+	qint32 centerX, centerY;
+	float hullArea;
+	qint32 hullPoints;
+};
+#pragma pack(pop)
+
+enum CacheFrameFlags {
+	CacheFrameSkipped = 1,      // no detection ran, tracking is skipped on replay
+	CacheFrameReset = 2         // tracks were dropped before this frame
+};
+
+class DetectionCacheWriter {
+public:
+	explicit DetectionCacheWriter(const QString& filename);
+	~DetectionCacheWriter();    // writes the index
+	bool isOpen() const { return _file.isOpen(); }
+	void write(int frame, const std::list<CarDescriptor>& cars);
+	void skip(int frame);       // the foreground was not ready
+	void markReset() { _pendingFlags |= CacheFrameReset; }  // applies to the next frame
+
+private:
+	QFile _file;
+	int _firstFrame;
+	quint32 _pendingFlags;
+	QVector<CacheIndexEntry> _index;
+	std::vector<CachedBlob> _buffer;
+	bool addEntry(int frame, quint32 count, quint32 flags);
+};
+
+// Read side, the file is memory-mapped
+class DetectionCache {
+public:
+	DetectionCache() : _data(nullptr), _header(nullptr), _index(nullptr) { }
+	~DetectionCache() { close(); }
+	bool open(const QString& filename);
+	void close();
+	bool isOpen() const { return _data != nullptr; }
+
+	int firstFrame() const { return _header->firstFrame; }
+	int frames() const { return _header->frames; }
+	const CachedBlob* blobs(int frame, int& count) const;
+	quint32 flags(int frame) const;
+
+	// Tracking and counting over the whole cache with new segments
+	QVector<int> recount(const QVector<QLineF>& segments, const DetectParams& params = DetectParams()) const;
+
+private:
+	QFile _file;
+	const uchar* _data;
+	const CacheHeader* _header;
+	const CacheIndexEntry* _index;
+};
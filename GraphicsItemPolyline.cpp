@@ -3,6 +3,7 @@
 #include <QGraphicsScene>
 #include <QGraphicsSceneMouseEvent>
 #include <QPainter>
+#include <QTimerEvent>
 
 GraphicsItemPolylinePoint::GraphicsItemPolylinePoint(const QRectF& rect, const QBrush& brush, QGraphicsItem* parent) :
 	QGraphicsObject(parent),
@@ -56,7 +57,6 @@ GraphicsItemPolyline::Item::Item(const QPointF& point, GraphicsItemPolyline* par
 	object->setPos(point);
 	QObject::connect(object, SIGNAL(xChanged()), parent, SLOT(itemPosChanged()));
 	QObject::connect(object, SIGNAL(yChanged()), parent, SLOT(itemPosChanged()));
-	QObject::connect(object, SIGNAL(zChanged()), parent, SLOT(itemPosChanged()));
 	QObject::connect(object, SIGNAL(deletePoint()), parent, SLOT(menuDeletePoint()));
 	object->setFlag(ItemIsMovable);
 }
@@ -67,7 +67,8 @@ GraphicsItemPolyline::GraphicsItemPolyline(QGraphicsScene* scene, QGraphicsItem*
 	_brush(Qt::red),
 	_pen(Qt::red),
 	_penInverted(Qt::blue),
-	_ptSize(10, 10)
+	_ptSize(10, 10),
+	_segmentsDirty(false)
 {
 	_menu = new QMenu();
 	auto action = new QAction(this);
@@ -98,13 +99,7 @@ GraphicsItemPolyline::~GraphicsItemPolyline() {
 }
 
 QRectF GraphicsItemPolyline::boundingRect() const {
-	QMutexLocker lock(&_mutex);
-	for (auto &item : _points) {
-		auto rect = item.object->boundingRect();
-		auto newCenter = item.object->pos();
-		rect.moveCenter(newCenter);
-		_boundRect = _boundRect.united(rect);
-	}
+	// maintained incrementally by GrowBoundingRect/RebuildBoundingRect
 	return _boundRect;
 }
 
@@ -158,7 +153,8 @@ void GraphicsItemPolyline::mousePressEvent(QGraphicsSceneMouseEvent* ev) {
 void GraphicsItemPolyline::InsertPoint(int pos, const QPointF& pt) {
 	QMutexLocker lock(&_mutex);
 	_points.insert(pos, Item(pt, this));
-	emit segmentsUpdated(segments());
+	GrowBoundingRect(pt);
+	PublishSegments();
 	update();
 }
 
@@ -168,7 +164,8 @@ bool GraphicsItemPolyline::UpdatePoint(int pos) {
 	auto newValue = point.object->pos();
 	if (point.cache != newValue) {
 		point.cache = newValue;
-		emit segmentsUpdated(segments());
+		GrowBoundingRect(newValue);
+		SchedulePublish();
 		return true;
 	}
 	return false;
@@ -178,11 +175,61 @@ void GraphicsItemPolyline::DeletePoint(int pos) {
 	QMutexLocker lock(&_mutex);
 	scene()->removeItem(_points[pos].object);
 	_points.removeAt(pos);
-	emit segmentsUpdated(segments());
+	RebuildBoundingRect();
+	PublishSegments();
 	update();
 }
 
 
+QRectF GraphicsItemPolyline::PointRect(const QPointF& pt) const {
+	return QRectF(QPointF(pt.x() - _ptSize.width() / 2, pt.y() - _ptSize.height() / 2), _ptSize);
+}
+
+void GraphicsItemPolyline::GrowBoundingRect(const QPointF& pt) {
+	// The rect only grows while dragging, so the scene index is touched
+	// only when a point leaves the current bounds.
+	QRectF rect = PointRect(pt);
+	if (!_boundRect.contains(rect)) {
+		prepareGeometryChange();
+		_boundRect = _boundRect.united(rect);
+	}
+}
+
+void GraphicsItemPolyline::RebuildBoundingRect() {
+	QMutexLocker lock(&_mutex);
+	QRectF rect;
+	for (auto &item : _points)
+		rect = rect.united(PointRect(item.cache));
+	if (rect != _boundRect) {
+		prepareGeometryChange();
+		_boundRect = rect;
+	}
+}
+
+void GraphicsItemPolyline::PublishSegments() {
+	_segmentsDirty = false;
+	emit segmentsUpdated(segments());
+}
+
+void GraphicsItemPolyline::SchedulePublish() {
+	_segmentsDirty = true;
+	if (!_publishTimer.isActive())
+		_publishTimer.start(publishIntervalMs, this);
+}
+
+void GraphicsItemPolyline::timerEvent(QTimerEvent* ev) {
+	if (ev->timerId() != _publishTimer.timerId()) {
+		QGraphicsObject::timerEvent(ev);
+		return;
+	}
+	// Keep ticking while the drag continues, stop after the first idle interval
+	if (_segmentsDirty)
+		PublishSegments();
+	else
+		_publishTimer.stop();
+}
+
+
 
 // slots & utility
 
@@ -246,6 +293,6 @@ void GraphicsItemPolyline::menuInvertSegment() {
 	int pos = IndexOfSegment(_menuPoint);
 	auto &point = _points[pos];
 	point.invertDirection = !point.invertDirection;
-	emit segmentsUpdated(segments());
+	PublishSegments();
 	update();
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <QBasicTimer>
 #include <QGraphicsItem>
 #include <QVector>
 #include <QBrush>
@@ -36,8 +37,12 @@ public:
 	QVector<QLineF> segments() const;
 	Q_SIGNAL void segmentsUpdated(const QVector<QLineF>& segments);
 
+	// Point drags are coalesced and published at most once per interval
+	static const int publishIntervalMs = 1001 / 24;
+
 protected:
 	void mousePressEvent(QGraphicsSceneMouseEvent *event) override;
+	void timerEvent(QTimerEvent *event) override;
 
 private:
 	mutable QMutex _mutex;
@@ -47,8 +52,10 @@ private:
 	QPen _penInverted;
 	QMenu *_menu;
 	QPointF _menuPoint;
-	mutable QRectF _boundRect;
+	QRectF _boundRect;
 	QAction *_invertDirectionAction;
+	QBasicTimer _publishTimer;
+	bool _segmentsDirty;
 
 	struct Item {
 		QPointF cache;
@@ -65,6 +72,11 @@ private:
 	void InsertPoint(int pos, const QPointF& pt);
 	bool UpdatePoint(int pos);
 	void DeletePoint(int pos);
+	QRectF PointRect(const QPointF& pt) const;
+	void GrowBoundingRect(const QPointF& pt);
+	void RebuildBoundingRect();
+	void PublishSegments();
+	void SchedulePublish();
 
 	Q_SLOT void itemPosChanged();
 	Q_SLOT void menuAddPoint();
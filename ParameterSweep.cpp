@@ -0,0 +1,159 @@
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QSettings>
+#include <QStringList>
+#include <QTextStream>
+#include <QWaitCondition>
+#include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <thread>
+
+#include "ParameterSweep.h"
+
+namespace {
+
+// Frames shared between the decoder and the workers
+struct FrameRing {
+	QMutex mutex;
+	QWaitCondition changed;
+	std::vector<cv::Mat> frames;
+	int produced;               // frames decoded so far
+	bool finished;
+	std::vector<int> consumed;  // per worker
+	FrameRing(int size, int workers) : frames(size), produced(0), finished(false), consumed(workers, 0) { }
+};
+
+void sweepWorker(FrameRing& ring, int worker, const QVector<QLineF>& segments, const SweepConfig& config, SweepResult& result) {
+	SweepPipeline pipeline;
+	DetectContext ctx;
+	ctx.params = config.params;
+	ctx.segments = segments;
+	ctx.carsCount.resize(segments.size());
+	qint64 nanoseconds = 0;
+	QElapsedTimer timer;
+	for (;;) {
+		cv::Mat frame;
+		{
+			QMutexLocker lock(&ring.mutex);
+			int index = ring.consumed[worker];
+			while (index >= ring.produced && !ring.finished)
+				ring.changed.wait(&ring.mutex);
+			if (index >= ring.produced)
+				break;
+			frame = ring.frames[index % ring.frames.size()];
+		}
+		timer.start();
+		pipeline.run(ctx, frame);
+		nanoseconds += timer.nsecsElapsed();
+		{
+			QMutexLocker lock(&ring.mutex);
+			++ring.consumed[worker];
+			ring.changed.wakeAll();
+		}
+	}
+	result.carsCount = ctx.carsCount;
+	result.frames = ctx.frameCount;
+	result.seconds = nanoseconds / 1e9;
+}
+
+QVector<QLineF> parseSegments(const QString& text) {
+	QVector<QLineF> segments;
+	for (auto &item : text.split(';', QString::SkipEmptyParts)) {
+		QStringList v = item.split(' ', QString::SkipEmptyParts);
+		if (v.size() == 4)
+			segments.push_back(QLineF(v[0].toDouble(), v[1].toDouble(), v[2].toDouble(), v[3].toDouble()));
+	}
+	return segments;
+}
+
+}
+
+QVector<SweepResult> sweep(const QString& videoFile, const QVector<QLineF>& segments, const QVector<SweepConfig>& configs, int ringSize) {
+	QVector<SweepResult> results(configs.size());
+	cv::VideoCapture capture(videoFile.toStdString());
+	if (!capture.isOpened())
+		return results;
+
+	FrameRing ring(ringSize, configs.size());
+	std::vector<std::thread> workers;
+	for (int i = 0; i < configs.size(); ++i)
+		workers.emplace_back(sweepWorker, std::ref(ring), i, std::cref(segments), std::cref(configs[i]), std::ref(results[i]));
+
+	cv::Mat decoded;
+	while (capture.read(decoded)) {
+		// a fresh buffer per frame, workers still read the older ones
+		cv::Mat scaled;
+		cv::resize(decoded, scaled, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
+		QMutexLocker lock(&ring.mutex);
+		while (ring.produced - *std::min_element(ring.consumed.begin(), ring.consumed.end()) >= ringSize)
+			ring.changed.wait(&ring.mutex);
+		ring.frames[ring.produced % ringSize] = scaled;
+		++ring.produced;
+		ring.changed.wakeAll();
+	}
+	{
+		QMutexLocker lock(&ring.mutex);
+		ring.finished = true;
+		ring.changed.wakeAll();
+	}
+	for (auto &worker : workers)
+		worker.join();
+	return results;
+}
+
+int runSweep(const QString& videoFile, const QString& sweepFile) {
+	QTextStream out(stdout);
+	QSettings settings(sweepFile, QSettings::IniFormat);
+	QVector<QLineF> segments = parseSegments(settings.value("sweep/segments").toString());
+	QVector<int> groundTruth;
+	for (auto &v : settings.value("sweep/groundTruth").toString().split(' ', QString::SkipEmptyParts))
+		groundTruth.push_back(v.toInt());
+	if (segments.isEmpty()) {
+		out << "no segments in " << sweepFile << endl;
+		return 1;
+	}
+
+	QVector<SweepConfig> configs;
+	for (auto &group : settings.childGroups()) {
+		if (group == "sweep")
+			continue;
+		settings.beginGroup(group);
+		SweepConfig config;
+		config.name = group;
+		DetectParams &p = config.params;
+		p.threshold = settings.value("threshold", p.threshold).toDouble();
+		p.blurSize = settings.value("blurSize", p.blurSize).toInt() | 1;
+		p.morphologyRounds = settings.value("morphologyRounds", p.morphologyRounds).toInt();
+		p.minArea = settings.value("minArea", p.minArea).toInt();
+		p.minWidth = settings.value("minWidth", p.minWidth).toInt();
+		p.minHeight = settings.value("minHeight", p.minHeight).toInt();
+		p.minDiagonal = settings.value("minDiagonal", p.minDiagonal).toDouble();
+		p.maxFramesWithoutMatch = settings.value("maxFramesWithoutMatch", p.maxFramesWithoutMatch).toInt();
+		settings.endGroup();
+		configs.push_back(config);
+	}
+	if (configs.isEmpty())
+		configs.push_back(SweepConfig{ "default", DetectParams() });
+
+	QElapsedTimer wall;
+	wall.start();
+	QVector<SweepResult> results = sweep(videoFile, segments, configs);
+	out << "configurations: " << configs.size() << ", wall time: " << wall.elapsed() / 1000.0 << " s" << endl;
+
+	out << "name\tcounts\terror\tfps" << endl;
+	for (int i = 0; i < configs.size(); ++i) {
+		const SweepResult &r = results[i];
+		QStringList counts;
+		int error = 0;
+		for (int j = 0; j < r.carsCount.size(); ++j) {
+			counts << QString::number(r.carsCount[j]);
+			if (j < groundTruth.size())
+				error += std::abs(r.carsCount[j] - groundTruth[j]);
+		}
+		out << configs[i].name << '\t' << counts.join(' ') << '\t'
+			<< (groundTruth.isEmpty() ? QString("-") : QString::number(error)) << '\t'
+			<< (r.seconds > 0 ? r.frames / r.seconds : 0.0) << endl;
+	}
+	return 0;
+}
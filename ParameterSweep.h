@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QLineF>
+#include <QString>
+#include <QVector>
+
+#include "processing.h"
+
+// Decode-once parameter sweep. Every frame is decoded and scaled once and
+// then shared by all configurations, each running its own SweepPipeline on
+// a separate thread. The decoder runs ahead by at most ringSize frames.
+struct SweepConfig {
+	QString name;
+	DetectParams params;
+};
+
+struct SweepResult {
+	QVector<int> carsCount;
+	int frames;
+	double seconds;             // time spent in the pipeline only
+};
+
+QVector<SweepResult> sweep(const QString& videoFile, const QVector<QLineF>& segments, const QVector<SweepConfig>& configs, int ringSize = 32);
+
+// Command line entry: CarCounter --sweep <video> <sweep.ini>
+//
+// [sweep]
+// segments = "x1 y1 x2 y2; x1 y1 x2 y2"   ; segment coordinates (half scale)
+// groundTruth = "12 7"                    ; optional, per segment
+// [<config name>]
+// threshold = 15                          ; any DetectParams field, others default
+int runSweep(const QString& videoFile, const QString& sweepFile);
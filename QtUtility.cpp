@@ -1,6 +1,8 @@
+#include <QMetaMethod>
 #include <QTimerEvent>
 
 #include "QtUtility.h"
+#include "Tracer.h"
 
 // class QtCVImage
 
@@ -70,55 +72,210 @@ QtCVImage& QtCVImage::operator=(const QVideoFrame& frame) {
 
 
 
-// class AbstractFilter
 
-void AbstractFilter::start() {
+// class FrameNode
+
+void FrameNode::addSink(FrameNode* sink) {
+	if (!_sinks.contains(sink))
+		_sinks.push_back(sink);
+}
+
+void FrameNode::removeSink(FrameNode* sink) {
+	_sinks.removeAll(sink);
+}
+
+void FrameNode::deliver(const SharedFrame& frame) {
+	for (auto sink : _sinks)
+		sink->push(frame);
+	// conversion to QImage is only worth it when somebody shows the frame
+	if (isSignalConnected(QMetaMethod::fromSignal(&FrameNode::newFrame))) {
+		TRACE_SCOPE("toQImage");
+		QtCVImage i(frame.mat());
+		// queued copies share the image data, so the cache key identifies it in the GUI thread
+		Tracer::flowStart("image", i.image().cacheKey());
+		emit newFrame(i.image());
+	}
+}
+
+
+
+// class VideoSource
+
+void VideoSource::start() {
 	if (!_timer.isActive()) {
 		_frameCount = 0;
 		_timer.start((int)(1001 / 24), this);
 	}
 }
 
-void AbstractFilter::stop() {
+void VideoSource::stop() {
 	_timer.stop();
 }
 
 
-void AbstractFilter::timerEvent(QTimerEvent* ev) {
+void VideoSource::timerEvent(QTimerEvent* ev) {
 	if (ev->timerId() != _timer.timerId())
 		return;
 	cv::Mat frame;
-	// Next statement blocks until a new frame is ready
-	if (!_videoCapture->read(frame)) {
-		_timer.stop();
-		return;
-	}
-	_frameCount++;
-	if (process(frame)) {
-		QtCVImage i(frame);
-		emit newFrame(i.image());
+	{
+		TRACE_SCOPE("decode", _frameCount + 1);
+		// Next statement blocks until a new frame is ready
+		if (!_videoCapture->read(frame)) {
+			_timer.stop();
+			return;
+		}
 	}
+	++_frameCount;
+	TRACE_SCOPE("deliver", _frameCount);
+	deliver(SharedFrame(frame, _frameCount, steadyClockMs()));
 }
 
-bool AbstractFilter::open(cv::VideoCapture* capturePtr) {
+bool VideoSource::open(cv::VideoCapture* capturePtr) {
 	if (_timer.isActive())
 		stop();
-	if (!capturePtr->isOpened())
+	if (!capturePtr->isOpened()) {
+		delete capturePtr;
 		return false;
+	}
 	_videoCapture.reset(capturePtr);
 
 	start();
 	return true;
 }
 
-bool AbstractFilter::open(const QString& filename) {
+bool VideoSource::open(const QString& filename) {
 	return open(new cv::VideoCapture(filename.toStdString()));
 }
 
-bool AbstractFilter::open(int cvCamId) {
+bool VideoSource::open(int cvCamId) {
 	return open(new cv::VideoCapture(cvCamId));
 }
 
+void VideoSource::close() {
+	stop();
+	_videoCapture.reset();
+}
+
+
+
+// class LiveSource
+
+LiveSource::LiveSource(QObject* parent) :
+	FrameNode(parent),
+	_pending(false),
+	_droppedFrames(0),
+	_latencyMs(0),
+	_lastStatistics(0)
+{
+	// empty
+}
+
+LiveSource::~LiveSource() {
+	close();
+}
+
+bool LiveSource::open(cv::VideoCapture* capturePtr) {
+	close();
+	if (!capturePtr->isOpened()) {
+		delete capturePtr;
+		return false;
+	}
+	// not every backend supports it, the grab thread drains the rest
+	capturePtr->set(cv::CAP_PROP_BUFFERSIZE, 1);
+	_grabber = std::make_shared<Grabber>();
+	_grabber->capture.reset(capturePtr);
+	_grabber->owner = this;
+	_droppedFrames = 0;
+	_latencyMs = 0;
+	std::thread(&LiveSource::grabLoop, _grabber).detach();
+	return true;
+}
+
+bool LiveSource::open(int cvCamId) {
+	return open(new cv::VideoCapture(cvCamId));
+}
+
+bool LiveSource::open(const QString& url) {
+	return open(new cv::VideoCapture(url.toStdString()));
+}
+
+void LiveSource::close() {
+	if (!_grabber)
+		return;
+	{
+		QMutexLocker lock(&_grabber->mutex);
+		_grabber->owner = nullptr;
+		_grabber->latest = SharedFrame();
+	}
+	_grabber.reset();
+}
+
+void LiveSource::grabLoop(std::shared_ptr<Grabber> grabber) {
+	Tracer::setThreadName("grab");
+	int frameCount = 0;
+	for (;;) {
+		TRACE_SCOPE("grab", frameCount + 1);
+		cv::Mat frame;
+		bool ok = grabber->capture->read(frame);
+		// the owner cannot be destroyed while the lock is held
+		QMutexLocker lock(&grabber->mutex);
+		LiveSource* owner = grabber->owner;
+		if (!owner)
+			break;
+		if (!ok) {
+			emit owner->failed();
+			break;
+		}
+		int dropped = 0;
+		if (!grabber->latest.empty()) {
+			++owner->_droppedFrames;
+			dropped = grabber->latest.number();
+		}
+		grabber->latest = SharedFrame(frame, ++frameCount, steadyClockMs());
+		// a replaced frame's hand-off ends here instead of on the filter thread
+		if (dropped)
+			Tracer::flowEnd("live", dropped);
+		Tracer::flowStart("live", frameCount);
+		if (!owner->_pending.exchange(true))
+			QMetaObject::invokeMethod(owner, "deliverLatest", Qt::QueuedConnection);
+	}
+}
+
+void LiveSource::deliverLatest() {
+	_pending = false;
+	if (!_grabber)
+		return;
+	SharedFrame frame;
+	{
+		QMutexLocker lock(&_grabber->mutex);
+		std::swap(frame, _grabber->latest);
+	}
+	if (frame.empty())
+		return;
+	TRACE_SCOPE("deliver", frame.number());
+	Tracer::flowEnd("live", frame.number());
+	deliver(frame);
+
+	qint64 now = steadyClockMs();
+	_latencyMs = (int)(now - frame.timestamp());
+	if (now - _lastStatistics >= 1000) {
+		_lastStatistics = now;
+		emit statistics(_droppedFrames, _latencyMs);
+	}
+}
+
+
+
+// class AbstractFilter
+
+void AbstractFilter::push(const SharedFrame& frame) {
+	TRACE_SCOPE("filter", frame.number());
+	_frameCount++;
+	SharedFrame result = frame;
+	if (process(result))
+		deliver(result);
+}
+
 
 
 
@@ -2,6 +2,13 @@
 
 #include <QBasicTimer>
 #include <QImage>
+#include <QMutex>
+#include <QObject>
+#include <QVector>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
 #ifdef VIDEOFRAME_SUPPORT
 #	include <QVideoFrame>
 #endif
@@ -34,27 +41,74 @@ private:
 
 };
 
-class AbstractFilter : public QObject {
+// Monotonic clock for frame timestamps, ms
+inline qint64 steadyClockMs() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Reference-counted read-only video frame. Copies share the pixel buffer.
+class SharedFrame {
+public:
+	SharedFrame() : _number(0), _timestamp(0) { }
+	explicit SharedFrame(const cv::Mat& mat, int number = 0, qint64 timestamp = 0) :
+		_mat(mat), _number(number), _timestamp(timestamp) { }
+
+	const cv::Mat& mat() const { return _mat; }
+	int number() const { return _number; }
+	qint64 timestamp() const { return _timestamp; }     // capture time, steadyClockMs()
+	bool empty() const { return _mat.empty(); }
+
+	void reset(const cv::Mat& mat) { _mat = mat; }
+
+private:
+	cv::Mat _mat;
+	int _number;
+	qint64 _timestamp;
+};
+
+// Node of a filter graph. Frames are pushed synchronously to every sink on
+// the thread of the producing node, so all nodes of one chain should live
+// on the same thread; sinks that need their own thread queue internally.
+class FrameNode : public QObject {
 	Q_OBJECT
 public:
-	explicit AbstractFilter(QObject* parent = nullptr) :
-		QObject(parent),
+	explicit FrameNode(QObject* parent = nullptr) :
+		QObject(parent)
+	{
+		// empty
+	}
+	Q_SLOT void addSink(FrameNode* sink);
+	Q_SLOT void removeSink(FrameNode* sink);
+	Q_SIGNAL void newFrame(const QImage& image);
+
+	virtual void push(const SharedFrame& frame) {
+		deliver(frame);
+	}
+
+protected:
+	void deliver(const SharedFrame& frame);
+
+private:
+	QVector<FrameNode*> _sinks;
+};
+
+// Source node decoding a file or a camera
+class VideoSource : public FrameNode {
+	Q_OBJECT
+public:
+	explicit VideoSource(QObject* parent = nullptr) :
+		FrameNode(parent),
 		_frameCount(0)
 	{
 		// empty
 	}
 	Q_SLOT bool open(const QString& filename);
 	Q_SLOT bool open(int cvCamId);
-	Q_SIGNAL void newFrame(const QImage& image);
+	Q_SLOT void close();
 
 protected:
 	int _frameCount;
 
-	virtual bool process(cv::Mat& mat) {
-		Q_UNUSED(mat);
-		return true; // use false to skip the frame
-	}
-
 private:
 	QScopedPointer<cv::VideoCapture> _videoCapture;
 	QBasicTimer _timer;
@@ -65,4 +119,63 @@ private:
 
 };
 
+// Source node for live cameras. A dedicated thread keeps draining the
+// device so the driver buffer never fills up, and the processing thread
+// is handed only the newest frame; older undelivered frames are dropped.
+class LiveSource : public FrameNode {
+	Q_OBJECT
+public:
+	explicit LiveSource(QObject* parent = nullptr);
+	~LiveSource();
+	Q_SLOT bool open(int cvCamId);
+	Q_SLOT bool open(const QString& url);
+	Q_SLOT void close();
+
+	int droppedFrames() const { return _droppedFrames; }
+	int latencyMs() const { return _latencyMs; }   // capture to the end of processing
+	Q_SIGNAL void statistics(int droppedFrames, int latencyMs);   // about once per second
+	Q_SIGNAL void failed();   // the stream ended or the camera stopped responding
+
+private:
+	// Shared with the grab thread, which is detached: close() does not wait
+	// for a read() stalled on a dead stream, the thread frees the capture itself.
+	struct Grabber {
+		QScopedPointer<cv::VideoCapture> capture;
+		QMutex mutex;
+		LiveSource* owner;  // cleared by close()
+		SharedFrame latest;
+	};
+	std::shared_ptr<Grabber> _grabber;
+	std::atomic<bool> _pending;
+	std::atomic<int> _droppedFrames;
+	std::atomic<int> _latencyMs;
+	qint64 _lastStatistics;
+	bool open(cv::VideoCapture* capturePtr);
+	static void grabLoop(std::shared_ptr<Grabber> grabber);
+	Q_SLOT void deliverLatest();
+
+};
+
+// Processing node
+class AbstractFilter : public FrameNode {
+	Q_OBJECT
+public:
+	explicit AbstractFilter(QObject* parent = nullptr) :
+		FrameNode(parent),
+		_frameCount(0)
+	{
+		// empty
+	}
+	void push(const SharedFrame& frame) override;
+
+protected:
+	int _frameCount;
+
+	virtual bool process(SharedFrame& frame) {
+		Q_UNUSED(frame);
+		return true; // use false to skip the frame
+	}
+
+};
+
 bool intersects(const QLineF& l1, const QLineF& l2, bool& directionDown);
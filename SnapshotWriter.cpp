@@ -0,0 +1,132 @@
+#include <QDir>
+#include <QRunnable>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+
+#include "SnapshotWriter.h"
+
+class SnapshotTask : public QRunnable {
+public:
+	SnapshotTask(SnapshotWriter* writer, const SharedFrame& frame, const cv::Rect& rect, int segment, int sequence) :
+		_writer(writer), _frame(frame), _rect(rect), _segment(segment), _sequence(sequence)
+	{
+		// empty
+	}
+	void run() override {
+		_writer->write(_frame, _rect, _segment, _sequence);
+	}
+private:
+	SnapshotWriter* _writer;
+	SharedFrame _frame;
+	cv::Rect _rect;
+	int _segment, _sequence;
+};
+
+namespace {
+
+// Sequence number of the last line of the index, -1 if there is none
+int lastSequence(QFile& index) {
+	if (!index.open(QIODevice::ReadOnly))
+		return -1;
+	// lines are short, the tail is enough
+	index.seek(std::max<qint64>(0, index.size() - 4096));
+	QList<QByteArray> lines = index.readAll().split('\n');
+	index.close();
+	for (int i = lines.size() - 1; i >= 0; --i) {
+		bool ok;
+		int sequence = lines[i].left(lines[i].indexOf(',')).toInt(&ok);
+		if (ok)
+			return sequence;
+	}
+	return -1;
+}
+
+}
+
+class DestroyTask : public QRunnable {
+public:
+	explicit DestroyTask(SnapshotWriter* writer) : _writer(writer) { }
+	void run() override {
+		delete _writer;
+	}
+private:
+	SnapshotWriter* _writer;
+};
+
+SnapshotWriter::SnapshotWriter(const QString& directory, const QString& format, qint64 maxPendingBytes) :
+	_directory(directory),
+	_format(format),
+	_maxPendingBytes(maxPendingBytes),
+	_index(QDir(directory).filePath("index.csv")),
+	_pendingBytes(0),
+	_sequence(0),
+	_dropped(0)
+{
+	QDir().mkpath(directory);
+	bool exists = _index.exists();
+	if (exists)
+		_sequence = lastSequence(_index) + 1;
+	_index.open(QIODevice::Append | QIODevice::Text);
+	if (!exists)
+		_index.write("sequence,frame,timestamp,segment,x,y,width,height,file\n");
+	_pool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() / 2));
+}
+
+SnapshotWriter::~SnapshotWriter() {
+	_pool.waitForDone();
+}
+
+void SnapshotWriter::destroyLater(SnapshotWriter* writer) {
+	if (writer)
+		QThreadPool::globalInstance()->start(new DestroyTask(writer));
+}
+
+bool SnapshotWriter::enqueue(const SharedFrame& frame, const cv::Rect& rect, int segment) {
+	{
+		// several crops of one frame keep a single buffer alive
+		QMutexLocker lock(&_pendingMutex);
+		const cv::Mat &mat = frame.mat();
+		auto it = _pendingFrames.find(mat.datastart);
+		if (it != _pendingFrames.end())
+			++*it;
+		else {
+			qint64 bytes = (qint64)(mat.dataend - mat.datastart);
+			if (_pendingBytes + bytes > _maxPendingBytes) {
+				++_dropped;
+				return false;
+			}
+			_pendingBytes += bytes;
+			_pendingFrames.insert(mat.datastart, 1);
+		}
+	}
+	_pool.start(new SnapshotTask(this, frame, rect, segment, _sequence++));
+	return true;
+}
+
+void SnapshotWriter::write(const SharedFrame& frame, const cv::Rect& rect, int segment, int sequence) {
+	const cv::Mat &mat = frame.mat();
+	cv::Rect crop = rect & cv::Rect(0, 0, mat.cols, mat.rows);
+	if (crop.area() > 0) {
+		QString shard = QString("%1").arg(sequence / shardSize, 4, 10, QChar('0'));
+		QString file = QString("%1/%2.%3").arg(shard).arg(sequence, 6, 10, QChar('0')).arg(_format);
+		QDir(_directory).mkpath(shard);
+		// the ROI shares the frame buffer, imwrite encodes straight from it
+		if (cv::imwrite(QDir(_directory).filePath(file).toStdString(), mat(crop))) {
+			QMutexLocker lock(&_indexMutex);
+			QTextStream(&_index) << sequence << ',' << frame.number() << ',' << frame.timestamp() << ',' << segment << ','
+				<< crop.x << ',' << crop.y << ',' << crop.width << ',' << crop.height << ',' << file << '\n';
+		}
+	}
+	release(frame);
+}
+
+void SnapshotWriter::release(const SharedFrame& frame) {
+	QMutexLocker lock(&_pendingMutex);
+	const cv::Mat &mat = frame.mat();
+	auto it = _pendingFrames.find(mat.datastart);
+	if (it != _pendingFrames.end() && --*it == 0) {
+		_pendingFrames.erase(it);
+		_pendingBytes -= (qint64)(mat.dataend - mat.datastart);
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <QFile>
+#include <QHash>
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+#include <atomic>
+#include <opencv2/opencv.hpp>
+
+#include "QtUtility.h"
+
+// Stores crops of counted cars on a thread pool. enqueue() keeps only a
+// reference to the full-resolution frame, cropping and encoding happen on
+// the pool. Files go to <directory>/<shard>/<sequence>.<format>, at most
+// shardSize per shard, and every stored crop gets a line in
+// <directory>/index.csv. Sequence numbers continue after the last one in
+// an existing index, so sessions never overwrite each other's files. The
+// queue is bounded by the size of the distinct frames it keeps alive: past
+// maxPendingBytes, snapshots of new frames are dropped.
+class SnapshotWriter {
+public:
+	static const int shardSize = 1000;
+
+	explicit SnapshotWriter(const QString& directory, const QString& format = "jpg", qint64 maxPendingBytes = 256 << 20);
+	~SnapshotWriter();      // waits for the queued writes
+	// Drains the queue and deletes the writer on a pool thread, so the
+	// caller does not wait for a slow disk
+	static void destroyLater(SnapshotWriter* writer);
+
+	bool enqueue(const SharedFrame& frame, const cv::Rect& rect, int segment);
+	int droppedSnapshots() const { return _dropped; }
+
+private:
+	friend class SnapshotTask;
+	QString _directory;
+	QString _format;
+	qint64 _maxPendingBytes;
+	QThreadPool _pool;
+	QMutex _indexMutex;
+	QFile _index;
+	QMutex _pendingMutex;
+	QHash<const uchar*, int> _pendingFrames;    // frame buffer -> queued snapshots
+	qint64 _pendingBytes;
+	std::atomic<int> _sequence;
+	std::atomic<int> _dropped;
+	void write(const SharedFrame& frame, const cv::Rect& rect, int segment, int sequence);
+	void release(const SharedFrame& frame);
+};
@@ -0,0 +1,168 @@
+#include <QFile>
+#include <QMutex>
+#include <QTextStream>
+#include <QThread>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include "Tracer.h"
+
+namespace {
+
+struct TraceEvent {
+	const char* name;
+	qint64 ts, dur;     // us
+	qint64 id;          // flow id
+	int frame;
+	char phase;
+};
+
+// Ring of the most recent events, written only by its own thread. The total
+// count is published with release order; save() copies the ring while the
+// thread goes on writing and keeps only what cannot have been overwritten.
+struct ThreadBuffer {
+	int tid;
+	QString name;
+	std::unique_ptr<TraceEvent[]> events;
+	std::atomic<qint64> count;
+	ThreadBuffer(int tid) : tid(tid), events(new TraceEvent[Tracer::eventsPerThread]), count(0) { }
+};
+
+QMutex registryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> registry;   // buffers outlive their threads
+thread_local ThreadBuffer* threadBuffer = nullptr;
+thread_local int threadFrame = 0;
+const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+ThreadBuffer* buffer() {
+	if (!threadBuffer) {
+		QMutexLocker lock(&registryMutex);
+		registry.emplace_back(new ThreadBuffer((int)registry.size() + 1));
+		threadBuffer = registry.back().get();
+		QThread* thread = QThread::currentThread();
+		threadBuffer->name = thread && !thread->objectName().isEmpty() ?
+			thread->objectName() : QString("thread %1").arg(threadBuffer->tid);
+	}
+	return threadBuffer;
+}
+
+void append(const TraceEvent& ev) {
+	ThreadBuffer* b = buffer();
+	qint64 n = b->count.load(std::memory_order_relaxed);
+	b->events[n & (Tracer::eventsPerThread - 1)] = ev;
+	b->count.store(n + 1, std::memory_order_release);
+}
+
+QString jsonString(const QString& text) {
+	QString result;
+	for (QChar c : text) {
+		if (c == '"' || c == '\\')
+			result += QChar('\\');
+		if (c.unicode() < 0x20)
+			result += QString("\\u%1").arg(c.unicode(), 4, 16, QChar('0'));
+		else
+			result += c;
+	}
+	return result;
+}
+
+}
+
+std::atomic<bool> Tracer::_enabled(false);
+
+qint64 Tracer::now() {
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+int& Tracer::currentFrame() {
+	return threadFrame;
+}
+
+void Tracer::start() {
+	_enabled = true;
+}
+
+void Tracer::stop() {
+	_enabled = false;
+}
+
+void Tracer::setThreadName(const char* name) {
+	if (isEnabled()) {
+		ThreadBuffer* b = buffer();
+		QMutexLocker lock(&registryMutex);
+		b->name = name;
+	}
+}
+
+void Tracer::complete(const char* name, qint64 begin, int frame) {
+	TraceEvent ev = { name, begin, now() - begin, 0, frame, 'X' };
+	append(ev);
+}
+
+void Tracer::flowStart(const char* name, qint64 id) {
+	if (isEnabled()) {
+		TraceEvent ev = { name, now(), 0, id, threadFrame, 's' };
+		append(ev);
+	}
+}
+
+void Tracer::flowEnd(const char* name, qint64 id) {
+	if (isEnabled()) {
+		TraceEvent ev = { name, now(), 0, id, threadFrame, 'f' };
+		append(ev);
+	}
+}
+
+bool Tracer::save(const QString& filename) {
+	QFile file(filename);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate | QIODevice::Text))
+		return false;
+	QTextStream out(&file);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	auto separator = [&]() -> QTextStream& {
+		if (!first)
+			out << ",";
+		first = false;
+		return out << "\n";
+	};
+
+	QMutexLocker lock(&registryMutex);
+	for (auto &b : registry) {
+		separator() << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":" << b->tid
+			<< ",\"args\":{\"name\":\"" << jsonString(b->name) << "\"}}";
+		const qint64 size = Tracer::eventsPerThread;
+		qint64 end = b->count.load(std::memory_order_acquire);
+		std::vector<TraceEvent> events;
+		for (qint64 i = std::max<qint64>(0, end - size); i < end; ++i)
+			events.push_back(b->events[i & (size - 1)]);
+		// events the thread may have overwritten while they were copied
+		qint64 overwritten = std::max<qint64>(0, b->count.load(std::memory_order_acquire) - size);
+		qint64 first = std::max<qint64>(0, end - size);
+		for (qint64 i = first; i < end; ++i) {
+			if (i < overwritten)
+				continue;
+			const TraceEvent &ev = events[i - first];
+			QString name = jsonString(QString::fromLatin1(ev.name));
+			separator() << "{\"ph\":\"" << ev.phase << "\",\"name\":\"" << name
+				<< "\",\"pid\":1,\"tid\":" << b->tid << ",\"ts\":" << ev.ts;
+			if (ev.phase == 'X')
+				out << ",\"dur\":" << ev.dur;
+			else {
+				out << ",\"cat\":\"" << name << "\",\"id\":" << ev.id;
+				// the arrow ends at the slice enclosing the event
+				if (ev.phase == 'f')
+					out << ",\"bp\":\"e\"";
+			}
+			out << ",\"args\":{\"frame\":" << ev.frame << "}}";
+		}
+		qint64 lost = std::max(first, overwritten);
+		if (lost)
+			separator() << "{\"ph\":\"i\",\"s\":\"t\",\"name\":\"" << lost << " older events overwritten\",\"pid\":1,\"tid\":" << b->tid
+				<< ",\"ts\":" << now() << "}";
+	}
+	out << "\n]}\n";
+	return out.status() == QTextStream::Ok;
+}
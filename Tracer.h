@@ -0,0 +1,72 @@
+#pragma once
+
+#include <QString>
+#include <QtGlobal>
+#include <atomic>
+
+// Opt-in timeline of the processing threads in Chrome trace-event format
+// (chrome://tracing, Perfetto). Every thread appends to its own ring of the
+// most recent eventsPerThread events without locks, so a trace saved after
+// a stall holds the events around it however long the process has run; when
+// tracing is off a scope costs one relaxed atomic load.
+//
+// Scopes become complete ("X") events tagged with the frame number, nested
+// scopes without a number inherit it from the enclosing one. Hand-offs
+// between threads are flow events: flowStart() on the producing side and
+// flowEnd() with the same id on the consuming side draw an arrow from one
+// slice to the other, so the time spent in a queue is visible.
+class Tracer {
+public:
+	static const int eventsPerThread = 1 << 18;    // a power of two
+
+	static bool isEnabled() { return _enabled.load(std::memory_order_relaxed); }
+	static void start();
+	static void stop();
+	// Writes the events still in the rings, may be called while threads trace
+	static bool save(const QString& filename);
+
+	// Name of the calling thread in the trace, QThread::objectName() by default
+	static void setThreadName(const char* name);
+	static void flowStart(const char* name, qint64 id);
+	static void flowEnd(const char* name, qint64 id);
+
+private:
+	friend class TraceScope;
+	static std::atomic<bool> _enabled;
+	static qint64 now();
+	static int& currentFrame();
+	static void complete(const char* name, qint64 begin, int frame);
+};
+
+class TraceScope {
+public:
+	// name must be a string literal, frame < 0 inherits the enclosing frame
+	explicit TraceScope(const char* name, int frame = -1) :
+		_name(Tracer::isEnabled() ? name : nullptr)
+	{
+		if (_name) {
+			_begin = Tracer::now();
+			int& current = Tracer::currentFrame();
+			_prevFrame = current;
+			if (frame >= 0)
+				current = frame;
+			_frame = current;
+		}
+	}
+	~TraceScope() {
+		if (_name) {
+			Tracer::complete(_name, _begin, _frame);
+			Tracer::currentFrame() = _prevFrame;
+		}
+	}
+
+private:
+	const char* _name;
+	qint64 _begin;
+	int _frame, _prevFrame;
+	Q_DISABLE_COPY(TraceScope)
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(...) TraceScope TRACE_CONCAT(traceScope, __LINE__)(__VA_ARGS__)
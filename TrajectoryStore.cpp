@@ -0,0 +1,127 @@
+#include <algorithm>
+#include <cmath>
+
+#include "TrajectoryStore.h"
+#include "processing.h"
+
+namespace {
+
+bool touches(const QLineF& line, const cv::Rect& rect) {
+	QRectF r(rect.x, rect.y, rect.width, rect.height);
+	if (r.contains(line.p1()) || r.contains(line.p2()))
+		return true;
+	QLineF edges[] = {
+		QLineF(r.topLeft(), r.topRight()), QLineF(r.topRight(), r.bottomRight()),
+		QLineF(r.bottomRight(), r.bottomLeft()), QLineF(r.bottomLeft(), r.topLeft())
+	};
+	QPointF pt;
+	for (auto &edge : edges)
+		if (line.intersect(edge, &pt) == QLineF::BoundedIntersection)
+			return true;
+	return false;
+}
+
+// Same order as LineCounting: a car is counted once, by the first segment it crosses downwards
+template <class Point>
+bool countTrajectory(const std::vector<Point>& points, const QVector<QLineF>& segments, QVector<int>& carsCount) {
+	for (size_t t = 1; t < points.size(); ++t) {
+		QLineF step(points[t - 1].x, points[t - 1].y, points[t].x, points[t].y);
+		for (int i = 0; i < segments.size(); ++i) {
+			bool directionDown;
+			if (intersects(segments[i], step, directionDown) && directionDown) {
+				++carsCount[i];
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+}
+
+template <class F>
+void TrajectoryStore::forEachCell(const cv::Rect& rect, F f) {
+	int x0 = std::max(0, rect.x) / cellSize, x1 = std::max(0, rect.br().x) / cellSize;
+	int y0 = std::max(0, rect.y) / cellSize, y1 = std::max(0, rect.br().y) / cellSize;
+	for (int cy = y0; cy <= y1; ++cy)
+		for (int cx = x0; cx <= x1; ++cx)
+			f(cellKey(cx, cy));
+}
+
+void TrajectoryStore::setWindow(int frames) {
+	_window = std::max(0, frames);
+	if (!_window)
+		clear();
+}
+
+void TrajectoryStore::clear() {
+	_firstId += (int)_trajectories.size();
+	_trajectories.clear();
+	_grid.clear();
+}
+
+void TrajectoryStore::add(CarDescriptor& car, int frame) {
+	if (!isEnabled() || car.centerPositions.size() < 2)
+		return;
+	Trajectory trajectory;
+	trajectory.points.reserve(car.centerPositions.size());
+	for (auto &pt : car.centerPositions)
+		trajectory.points.push_back(cv::Point_<short>(pt));
+	trajectory.bounds = cv::boundingRect(car.centerPositions);
+	trajectory.endFrame = frame;
+
+	int id = _firstId + (int)_trajectories.size();
+	forEachCell(trajectory.bounds, [&](qint64 key) {
+		_grid[key].push_back(id);
+	});
+	_trajectories.push_back(std::move(trajectory));
+}
+
+void TrajectoryStore::expire(int frame) {
+	while (!_trajectories.empty() && _trajectories.front().endFrame < frame - _window) {
+		// ids are appended in ascending order, so the oldest are at the front of each cell
+		forEachCell(_trajectories.front().bounds, [&](qint64 key) {
+			auto it = _grid.find(key);
+			if (it == _grid.end())
+				return;
+			auto &ids = it->second;
+			ids.erase(ids.begin(), std::upper_bound(ids.begin(), ids.end(), _firstId));
+			if (ids.empty())
+				_grid.erase(it);
+		});
+		_trajectories.pop_front();
+		++_firstId;
+	}
+}
+
+QVector<int> TrajectoryStore::recount(const QVector<QLineF>& segments, std::list<CarDescriptor>& live, int frame) {
+	expire(frame);
+	QVector<int> carsCount(segments.size());
+
+	// candidates: trajectories registered in the cells along the segments
+	std::vector<int> candidates;
+	for (auto &line : segments) {
+		cv::Rect rect(cv::Point((int)std::floor(std::min(line.x1(), line.x2())), (int)std::floor(std::min(line.y1(), line.y2()))),
+			cv::Point((int)std::ceil(std::max(line.x1(), line.x2())), (int)std::ceil(std::max(line.y1(), line.y2()))));
+		forEachCell(rect, [&](qint64 key) {
+			auto it = _grid.find(key);
+			if (it != _grid.end())
+				candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+		});
+	}
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+
+	for (int id : candidates) {
+		const Trajectory &trajectory = _trajectories[id - _firstId];
+		bool touched = false;
+		for (auto &line : segments)
+			if ((touched = touches(line, trajectory.bounds)))
+				break;
+		if (touched)
+			countTrajectory(trajectory.points, segments, carsCount);
+	}
+	for (auto &car : live)
+		car.isCounted = countTrajectory(car.centerPositions, segments, carsCount);
+	return carsCount;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <QLineF>
+#include <QRectF>
+#include <QVector>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+struct CarDescriptor;
+
+// Finished trajectories of the last `window` frames, indexed by a uniform
+// grid over their bounding boxes. When the segments change, only the
+// trajectories whose boxes touch a new segment are replayed, so counts for
+// the new geometry are available without waiting for fresh traffic.
+class TrajectoryStore {
+public:
+	static const int cellSize = 64;
+
+	TrajectoryStore() : _window(0), _firstId(0) { }
+	void setWindow(int frames);
+	void clear();
+	int window() const { return _window; }
+	bool isEnabled() const { return _window > 0; }
+	int size() const { return (int)_trajectories.size(); }
+
+	// Takes the positions of an expired track
+	void add(CarDescriptor& car, int frame);
+	// Drops trajectories that ended before frame - window
+	void expire(int frame);
+
+	// Counts over the trajectories of the window ending at frame and the live
+	// tracks as if the segments had always been there; isCounted of live
+	// tracks is updated.
+	QVector<int> recount(const QVector<QLineF>& segments, std::list<CarDescriptor>& live, int frame);
+
+private:
+	struct Trajectory {
+		std::vector<cv::Point_<short>> points;
+		cv::Rect bounds;
+		int endFrame;
+	};
+	int _window;
+	int _firstId;               // id of _trajectories.front()
+	std::deque<Trajectory> _trajectories;
+	std::unordered_map<qint64, std::vector<int>> _grid;    // cell -> ids, ascending
+
+	static qint64 cellKey(int cx, int cy) { return ((qint64)cy << 32) | (quint32)cx; }
+	template <class F> static void forEachCell(const cv::Rect& rect, F f);
+};
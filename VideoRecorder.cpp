@@ -0,0 +1,93 @@
+#include "VideoRecorder.h"
+#include "Tracer.h"
+
+VideoRecorder::VideoRecorder(QObject* parent) :
+	FrameNode(parent),
+	_running(false),
+	_droppedFrames(0),
+	_skipCounter(0),
+	_fps(0)
+{
+	// empty
+}
+
+VideoRecorder::~VideoRecorder() {
+	stop();
+}
+
+bool VideoRecorder::start(const QString& filename, double fps) {
+	stop();
+	_filename = filename.toStdString();
+	_fps = fps;
+	_droppedFrames = 0;
+	_skipCounter = 0;
+	_running = true;
+	_encoderThread = std::thread(&VideoRecorder::encodeLoop, this);
+	return true;
+}
+
+void VideoRecorder::stop() {
+	{
+		QMutexLocker lock(&_mutex);
+		_running = false;
+		_queueChanged.wakeAll();
+	}
+	if (_encoderThread.joinable())
+		_encoderThread.join();
+}
+
+void VideoRecorder::push(const SharedFrame& frame) {
+	if (_running) {
+		QMutexLocker lock(&_mutex);
+		int size = (int)_queue.size();
+		if (size >= maxQueue || (size >= maxQueue / 2 && (++_skipCounter & 1)))
+			++_droppedFrames;
+		else {
+			_queue.push_back(frame);
+			Tracer::flowStart("encode", frame.number());
+			_queueChanged.wakeOne();
+		}
+	}
+	deliver(frame);
+}
+
+void VideoRecorder::encodeLoop() {
+	Tracer::setThreadName("encoder");
+	cv::VideoWriter writer;
+	cv::Size size;
+	for (;;) {
+		SharedFrame frame;
+		{
+			QMutexLocker lock(&_mutex);
+			while (_running && _queue.empty())
+				_queueChanged.wait(&_mutex);
+			// flush what is queued before leaving
+			if (_queue.empty())
+				break;
+			frame = _queue.front();
+			_queue.pop_front();
+		}
+		TRACE_SCOPE("encode", frame.number());
+		Tracer::flowEnd("encode", frame.number());
+		const cv::Mat &mat = frame.mat();
+		if (!writer.isOpened()) {
+			// the frame size is known only now
+			if (!writer.open(_filename, cv::VideoWriter::fourcc('M', 'J', 'P', 'G'), _fps, mat.size(), mat.channels() == 3)) {
+				_running = false;
+				{
+					QMutexLocker lock(&_mutex);
+					_queue.clear();
+				}
+				emit failed(QString::fromStdString(_filename));
+				break;
+			}
+			size = mat.size();
+		}
+		// the container cannot change resolution on the fly
+		if (mat.size() != size) {
+			++_droppedFrames;
+			continue;
+		}
+		writer.write(mat);
+	}
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include <atomic>
+#include <deque>
+#include <thread>
+#include <opencv2/opencv.hpp>
+
+#include "QtUtility.h"
+
+// Sink node encoding the frames it receives with cv::VideoWriter on its own
+// thread. push() only queues a reference to the frame. When the encoder
+// falls behind, every other frame is skipped once the queue is half full
+// and everything is dropped when it is full, so the producer never blocks.
+class VideoRecorder : public FrameNode {
+	Q_OBJECT
+public:
+	static const int maxQueue = 48;
+
+	explicit VideoRecorder(QObject* parent = nullptr);
+	~VideoRecorder();
+	Q_SLOT bool start(const QString& filename, double fps = 24000.0 / 1001);
+	Q_SLOT void stop();
+	bool isRecording() const { return _running; }
+	int droppedFrames() const { return _droppedFrames; }
+
+	void push(const SharedFrame& frame) override;
+	// The file could not be opened for writing; emitted on the encoder thread
+	Q_SIGNAL void failed(const QString& filename);
+
+private:
+	std::thread _encoderThread;
+	QMutex _mutex;
+	QWaitCondition _queueChanged;
+	std::deque<SharedFrame> _queue;
+	std::atomic<bool> _running;
+	std::atomic<int> _droppedFrames;
+	int _skipCounter;
+	std::string _filename;
+	double _fps;
+	void encodeLoop();
+
+};
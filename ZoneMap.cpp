@@ -0,0 +1,96 @@
+#include <QSettings>
+#include <QStringList>
+
+#include "ZoneMap.h"
+#include "processing.h"
+
+QVector<QPolygonF> ZoneMap::load(const QString& filename) {
+	QSettings settings(filename, QSettings::IniFormat);
+	QVector<QPolygonF> zones;
+	for (auto &item : settings.value("zones/zones").toString().split(';', QString::SkipEmptyParts)) {
+		QStringList v = item.split(' ', QString::SkipEmptyParts);
+		QPolygonF polygon;
+		for (int i = 0; i + 1 < v.size(); i += 2)
+			polygon << QPointF(v[i].toDouble(), v[i + 1].toDouble());
+		if (polygon.size() >= 3)
+			zones.push_back(polygon);
+	}
+	return zones;
+}
+
+void ZoneMap::setZones(const QVector<QPolygonF>& zones) {
+	_zones = zones.mid(0, maxZones);
+	_stats = QVector<ZoneStats>(_zones.size());
+	_dirty = true;
+}
+
+void ZoneMap::rasterize(const cv::Size& size) {
+	_labels = cv::Mat::zeros(size, CV_32S);
+	cv::Mat mask(size, CV_8U);
+	for (int i = 0; i < _zones.size(); ++i) {
+		std::vector<cv::Point> polygon;
+		for (auto &pt : _zones[i])
+			polygon.push_back(cv::Point(qRound(pt.x()), qRound(pt.y())));
+		if (polygon.size() < 3)
+			continue;
+		mask.setTo(0);
+		cv::fillPoly(mask, std::vector<std::vector<cv::Point>>{ polygon }, cv::Scalar(255));
+		cv::Rect rect = cv::boundingRect(polygon) & cv::Rect(cv::Point(0, 0), size);
+		quint32 bit = 1u << i;
+		for (int y = rect.y; y < rect.br().y; ++y) {
+			const uchar* m = mask.ptr<uchar>(y);
+			quint32* l = reinterpret_cast<quint32*>(_labels.ptr<int>(y));
+			for (int x = rect.x; x < rect.br().x; ++x)
+				if (m[x])
+					l[x] |= bit;
+		}
+	}
+	_dirty = false;
+}
+
+void ZoneMap::update(std::list<CarDescriptor>& cars, int frameCount, const cv::Size& frameSize) {
+	if (_dirty || _labels.size() != frameSize)
+		rasterize(frameSize);
+	for (auto &stats : _stats)
+		stats.occupancy = 0;
+
+	for (auto &car : cars) {
+		// zones change on detections only, so a visit never outlasts lastSeenFrame
+		quint32 labels = car.zoneLabels;
+		if (car.isMatchFound) {
+			labels = car.centerPositions.empty() ? 0 : this->labels(car.centerPositions.back());
+			finishVisits(car, car.zoneLabels & ~labels, frameCount);
+			quint32 entered = labels & ~car.zoneLabels;
+			for (int i = 0; entered; ++i, entered >>= 1)
+				if (entered & 1)
+					car.zoneEntries.push_back(std::make_pair(i, frameCount));
+			car.zoneLabels = labels;
+		}
+		for (int i = 0; i < _stats.size(); ++i)
+			if (labels & (1u << i))
+				++_stats[i].occupancy;
+	}
+}
+
+void ZoneMap::close(CarDescriptor& car, int frameCount) {
+	finishVisits(car, car.zoneLabels, frameCount);
+	car.zoneLabels = 0;
+}
+
+void ZoneMap::finishVisits(CarDescriptor& car, quint32 left, int frameCount) {
+	if (!left)
+		return;
+	for (auto it = car.zoneEntries.begin(); it != car.zoneEntries.end(); ) {
+		if (left & (1u << it->first)) {
+			// the zones may have been replaced meanwhile
+			if (it->first < _stats.size()) {
+				ZoneStats &stats = _stats[it->first];
+				++stats.visits;
+				stats.totalDwellFrames += frameCount - it->second;
+			}
+			it = car.zoneEntries.erase(it);
+		}
+		else
+			++it;
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <QPolygonF>
+#include <QString>
+#include <QVector>
+#include <list>
+#include <opencv2/opencv.hpp>
+
+struct CarDescriptor;
+
+struct ZoneStats {
+	int occupancy;              // tracks inside the zone on the current frame
+	int visits;                 // tracks that have left the zone
+	qint64 totalDwellFrames;    // summed over the finished visits
+	ZoneStats() : occupancy(0), visits(0), totalDwellFrames(0) { }
+	double meanDwellFrames() const { return visits > 0 ? (double)totalDwellFrames / visits : 0.0; }
+};
+
+// Polygonal zones rasterised into a label map at tracking resolution when
+// the configuration or the frame size changes. Bit i of a label is set
+// when the pixel belongs to zone i, so zones may overlap (a lane and a
+// queue area). Finding the zones of a track is then a single read,
+// whatever the number or the shape of the polygons.
+class ZoneMap {
+public:
+	static const int maxZones = 32;
+
+	ZoneMap() : _dirty(false) { }
+	void setZones(const QVector<QPolygonF>& zones);
+	const QVector<QPolygonF>& zones() const { return _zones; }
+	const QVector<ZoneStats>& stats() const { return _stats; }
+	bool isEmpty() const { return _zones.isEmpty(); }
+
+	quint32 labels(const cv::Point& pt) const {
+		if (pt.x < 0 || pt.y < 0 || pt.x >= _labels.cols || pt.y >= _labels.rows)
+			return 0;
+		return (quint32)_labels.at<int>(pt.y, pt.x);
+	}
+
+	// Updates occupancy and dwell time from the last positions of the tracks
+	void update(std::list<CarDescriptor>& cars, int frameCount, const cv::Size& frameSize);
+	// Finishes the visits of a track that is no longer followed
+	void close(CarDescriptor& car, int frameCount);
+
+	// Zones as stored in the [zones] group of an INI file:
+	// zones = "x1 y1 x2 y2 x3 y3 ...; x1 y1 ..."   ; polygons in segment coordinates
+	static QVector<QPolygonF> load(const QString& filename);
+
+private:
+	QVector<QPolygonF> _zones;
+	QVector<ZoneStats> _stats;
+	cv::Mat _labels;            // CV_32S holding quint32 bit sets
+	bool _dirty;
+	void rasterize(const cv::Size& size);
+	void finishVisits(CarDescriptor& car, quint32 left, int frameCount);
+};
@@ -1,12 +1,33 @@
 #include <QApplication>
+#include <QDebug>
+#include <QThread>
 #include <opencv2/opencv.hpp>
 #include "mainwindow.h"
+#include "ParameterSweep.h"
+#include "Tracer.h"
 
 int main(int argc, char* argv[]) {
 //	qRegisterMetaType<cv::Mat>();
 	qRegisterMetaType<QVector<QLineF>>();
-	QApplication a(argc, argv);
-	MainWindow w;
-	w.show();
-	return a.exec();
+	qRegisterMetaType<QVector<int>>();
+	qRegisterMetaType<QVector<QPolygonF>>();
+	// CARCOUNTER_TRACE=timeline.json records a Chrome trace of the session
+	QString trace = QString::fromLocal8Bit(qgetenv("CARCOUNTER_TRACE"));
+	if (!trace.isEmpty())
+		Tracer::start();
+	int result;
+	if (argc == 4 && QString(argv[1]) == "--sweep") {
+		QCoreApplication a(argc, argv);
+		result = runSweep(QString::fromLocal8Bit(argv[2]), QString::fromLocal8Bit(argv[3]));
+	}
+	else {
+		QApplication a(argc, argv);
+		QThread::currentThread()->setObjectName("gui");
+		MainWindow w;
+		w.show();
+		result = a.exec();
+	}
+	if (!trace.isEmpty() && !Tracer::save(trace))
+		qWarning() << "Cannot write trace" << trace;
+	return result;
 }
@@ -1,9 +1,11 @@
 #include <QGraphicsPixmapItem>
 #include <QFileDialog>
+#include <QInputDialog>
 
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
 #include "GraphicsItemPolyline.h"
+#include "Tracer.h"
 
 MainWindow::MainWindow(QWidget *parent) :
 	QMainWindow(parent),
@@ -11,34 +13,241 @@ MainWindow::MainWindow(QWidget *parent) :
 {
 	ui->setupUi(this);
 	connect(ui->actionOpen_File, SIGNAL(triggered()), SLOT(actionFileOpen()));
+	connect(ui->actionOpen_Camera, SIGNAL(triggered()), SLOT(actionCameraOpen()));
+	connect(ui->actionCount_File, SIGNAL(triggered()), SLOT(actionFileCount()));
+	connect(ui->actionRecord, SIGNAL(toggled(bool)), SLOT(actionRecord(bool)));
+	connect(ui->actionSave_Snapshots, SIGNAL(toggled(bool)), SLOT(actionSaveSnapshots(bool)));
+	connect(ui->actionRecord_Detections, SIGNAL(toggled(bool)), SLOT(actionRecordDetections(bool)));
+	connect(ui->actionRecount_Detections, SIGNAL(triggered()), SLOT(actionRecountDetections()));
+	connect(ui->actionLoad_Zones, SIGNAL(triggered()), SLOT(actionLoadZones()));
+	connect(ui->actionZone_Statistics, SIGNAL(triggered()), SLOT(actionZoneStatistics()));
+	// dumps the recent timeline right after a stall, see CARCOUNTER_TRACE
+	if (Tracer::isEnabled())
+		ui->menuFile->addAction(tr("Save Trace..."), this, SLOT(actionSaveTrace()), QKeySequence(tr("Ctrl+T")));
+	auto modeGroup = new QActionGroup(this);
+	modeGroup->addAction(ui->actionDay_Mode);
+	modeGroup->addAction(ui->actionCoarse_Mode);
+	modeGroup->addAction(ui->actionNight_Mode);
+	connect(modeGroup, SIGNAL(triggered(QAction*)), SLOT(setMode(QAction*)));
 
 	ui->graphicsView->setScene(new QGraphicsScene(this));
 	pixmapItem.reset(new QGraphicsPixmapItem());
 	ui->graphicsView->scene()->addItem(pixmapItem.data());
+	filterThread.setObjectName("filter");
+	batchThread.setObjectName("batch");
+	filters << &dayFilter << &coarseFilter << &nightFilter;
+	activeFilter = &dayFilter;
+	cacheFilter = nullptr;
+	source.addSink(activeFilter);
+	liveSource.addSink(activeFilter);
 	filterThread.start();
-	filter.moveToThread(&filterThread);
+	source.moveToThread(&filterThread);
+	liveSource.moveToThread(&filterThread);
+	for (DetectFilter* filter : filters)
+		filter->moveToThread(&filterThread);
+	recorder.moveToThread(&filterThread);
 
 	polylineItem.reset(new GraphicsItemPolyline(ui->graphicsView->scene()));
-	filter.setSegments(polylineItem->segments());
-	connect(polylineItem.data(), SIGNAL(segmentsUpdated(QVector<QLineF>)), &filter, SLOT(setSegments(QVector<QLineF>)));
-	connect(&filter, SIGNAL(newFrame(QImage)), SLOT(setImage(QImage)));
+	for (DetectFilter* filter : filters) {
+		filter->setRecountWindow(recountMinutes * 60 * 24000 / 1001);
+		filter->setSegments(polylineItem->segments());
+		connect(polylineItem.data(), SIGNAL(segmentsUpdated(QVector<QLineF>)), filter, SLOT(setSegments(QVector<QLineF>)));
+		connect(filter, SIGNAL(newFrame(QImage)), SLOT(setImage(QImage)));
+		// annotated output of whichever filter is active
+		filter->addSink(&recorder);
+	}
+	connect(&liveSource, SIGNAL(statistics(int,int)), SLOT(liveStatistics(int,int)));
+	connect(&liveSource, SIGNAL(failed()), SLOT(liveFailed()));
+	connect(&recorder, SIGNAL(failed(QString)), SLOT(recordingFailed(QString)));
 
-	//QMetaObject::invokeMethod(&filter, "open", Q_ARG(QString, "c:\\Users\\Vyacheslav\\Projects\\TestVideo\\night.avi"));
+	batchThread.start();
+	batchCounter.moveToThread(&batchThread);
+	connect(&batchCounter, SIGNAL(finished(QString,QVector<int>)), SLOT(fileCounted(QString,QVector<int>)));
+	cacheRecounter.moveToThread(&batchThread);
+	connect(&cacheRecounter, SIGNAL(finished(QString,QVector<int>)), SLOT(fileCounted(QString,QVector<int>)));
+
+	//QMetaObject::invokeMethod(&source, "open", Q_ARG(QString, "c:\\Users\\Vyacheslav\\Projects\\TestVideo\\night.avi"));
 }
 
 MainWindow::~MainWindow() {
+	QMetaObject::invokeMethod(&recorder, "stop", Qt::BlockingQueuedConnection);
+	QMetaObject::invokeMethod(&liveSource, "close", Qt::BlockingQueuedConnection);
 	filterThread.quit();
 	filterThread.wait();
+	batchThread.quit();
+	batchThread.wait();
 	delete ui;
 }
 
 void MainWindow::setImage(const QImage& image) {
-	pixmapItem->setPixmap(QPixmap::fromImage(image));
+	TRACE_SCOPE("setImage");
+	Tracer::flowEnd("image", image.cacheKey());
+	QPixmap pixmap;
+	{
+		TRACE_SCOPE("QPixmap::fromImage");
+		pixmap = QPixmap::fromImage(image);
+	}
+	pixmapItem->setPixmap(pixmap);
 }
 
 void MainWindow::actionFileOpen() {
 	auto fileName = QFileDialog::getOpenFileName(this,
 		tr("Open Video"), QString(), tr("Video Files (*.*)"));
-	if (!fileName.isEmpty())
-		QMetaObject::invokeMethod(&filter, "open", Q_ARG(QString, fileName));
+	if (fileName.isEmpty())
+		return;
+	QMetaObject::invokeMethod(&liveSource, "close");
+	QMetaObject::invokeMethod(activeFilter, "reset");
+	QMetaObject::invokeMethod(&source, "open", Q_ARG(QString, fileName));
+}
+
+void MainWindow::actionCameraOpen() {
+	bool ok;
+	int camId = QInputDialog::getInt(this, tr("Open Camera"), tr("Camera index:"), 0, 0, 99, 1, &ok);
+	if (!ok)
+		return;
+	QMetaObject::invokeMethod(&source, "close");
+	QMetaObject::invokeMethod(activeFilter, "reset");
+	QMetaObject::invokeMethod(&liveSource, "open", Q_ARG(int, camId));
+}
+
+void MainWindow::liveStatistics(int droppedFrames, int latencyMs) {
+	ui->statusBar->showMessage(tr("Latency %1 ms, dropped %2 frames").arg(latencyMs).arg(droppedFrames));
+}
+
+void MainWindow::liveFailed() {
+	ui->statusBar->showMessage(tr("Camera stopped sending frames"));
+}
+
+void MainWindow::actionFileCount() {
+	auto fileName = QFileDialog::getOpenFileName(this,
+		tr("Count Video"), QString(), tr("Video Files (*.*)"));
+	if (fileName.isEmpty())
+		return;
+	QMetaObject::invokeMethod(&batchCounter, "setSegments", Q_ARG(QVector<QLineF>, polylineItem->segments()));
+	ui->statusBar->showMessage(tr("Counting %1...").arg(fileName));
+	QMetaObject::invokeMethod(&batchCounter, "run", Q_ARG(QString, fileName));
+}
+
+void MainWindow::actionRecord(bool enabled) {
+	if (!enabled) {
+		QMetaObject::invokeMethod(&recorder, "stop");
+		return;
+	}
+	auto fileName = QFileDialog::getSaveFileName(this,
+		tr("Record Video"), QString(), tr("AVI Files (*.avi)"));
+	if (fileName.isEmpty()) {
+		ui->actionRecord->setChecked(false);
+		return;
+	}
+	QMetaObject::invokeMethod(&recorder, "start", Q_ARG(QString, fileName));
+}
+
+void MainWindow::recordingFailed(const QString& filename) {
+	ui->actionRecord->setChecked(false);
+	ui->statusBar->showMessage(tr("Cannot record to %1").arg(filename));
+}
+
+void MainWindow::actionSaveSnapshots(bool enabled) {
+	// filters stop using the old writer before it is destroyed
+	for (DetectFilter* filter : filters)
+		filter->setSnapshotWriter(nullptr);
+	SnapshotWriter::destroyLater(snapshots.take());
+	if (!enabled)
+		return;
+	QString directory = QFileDialog::getExistingDirectory(this, tr("Snapshots Directory"));
+	if (directory.isEmpty()) {
+		ui->actionSave_Snapshots->setChecked(false);
+		return;
+	}
+	snapshots.reset(new SnapshotWriter(directory));
+	for (DetectFilter* filter : filters)
+		filter->setSnapshotWriter(snapshots.data());
+}
+
+void MainWindow::actionRecordDetections(bool enabled) {
+	if (!enabled) {
+		if (cacheFilter)
+			QMetaObject::invokeMethod(cacheFilter, "setDetectionCache", Q_ARG(QString, QString()));
+		cacheFilter = nullptr;
+		return;
+	}
+	// the night mode tracks differently, its detections cannot be replayed
+	if (activeFilter == &nightFilter) {
+		ui->statusBar->showMessage(tr("Detections are not recorded in the night mode"));
+		ui->actionRecord_Detections->setChecked(false);
+		return;
+	}
+	auto fileName = QFileDialog::getSaveFileName(this,
+		tr("Record Detections"), QString(), tr("Detection Cache (*.detections)"));
+	if (fileName.isEmpty()) {
+		ui->actionRecord_Detections->setChecked(false);
+		return;
+	}
+	cacheFilter = activeFilter;
+	QMetaObject::invokeMethod(cacheFilter, "setDetectionCache", Q_ARG(QString, fileName));
+}
+
+void MainWindow::actionRecountDetections() {
+	auto fileName = QFileDialog::getOpenFileName(this,
+		tr("Recount Detections"), QString(), tr("Detection Cache (*.detections)"));
+	if (fileName.isEmpty())
+		return;
+	QMetaObject::invokeMethod(&cacheRecounter, "setSegments", Q_ARG(QVector<QLineF>, polylineItem->segments()));
+	QMetaObject::invokeMethod(&cacheRecounter, "run", Q_ARG(QString, fileName));
+}
+
+void MainWindow::actionLoadZones() {
+	auto fileName = QFileDialog::getOpenFileName(this,
+		tr("Load Zones"), QString(), tr("Zones (*.ini)"));
+	if (fileName.isEmpty())
+		return;
+	QVector<QPolygonF> zones = ZoneMap::load(fileName);
+	for (DetectFilter* filter : filters)
+		QMetaObject::invokeMethod(filter, "setZones", Q_ARG(QVector<QPolygonF>, zones));
+	ui->statusBar->showMessage(tr("%1: %2 zones").arg(fileName).arg(zones.size()));
+}
+
+void MainWindow::actionZoneStatistics() {
+	QStringList items;
+	QVector<ZoneStats> stats = activeFilter->zoneStats();
+	for (int i = 0; i < stats.size(); ++i)
+		items << tr("zone %1: %2 now, %3 visits, %4 frames mean dwell").arg(i).arg(stats[i].occupancy)
+			.arg(stats[i].visits).arg(stats[i].meanDwellFrames(), 0, 'f', 1);
+	ui->statusBar->showMessage(items.isEmpty() ? tr("No zones") : items.join("; "));
+}
+
+void MainWindow::actionSaveTrace() {
+	auto fileName = QFileDialog::getSaveFileName(this,
+		tr("Save Trace"), QString(), tr("Chrome Trace (*.json)"));
+	if (fileName.isEmpty())
+		return;
+	if (!Tracer::save(fileName))
+		ui->statusBar->showMessage(tr("Cannot write %1").arg(fileName));
+}
+
+void MainWindow::fileCounted(const QString& filename, const QVector<int>& carsCount) {
+	QStringList counts;
+	for (int count : carsCount)
+		counts << QString::number(count);
+	ui->statusBar->showMessage(tr("%1: %2").arg(filename, counts.join(", ")));
+}
+
+void MainWindow::setMode(QAction* action) {
+	DetectFilter* filter = &dayFilter;
+	if (action == ui->actionNight_Mode)
+		filter = &nightFilter;
+	else if (action == ui->actionCoarse_Mode)
+		filter = &coarseFilter;
+	if (filter == activeFilter)
+		return;
+	ui->actionRecord_Detections->setChecked(false);
+	// whatever the filter saw when it was last active is stale now
+	QMetaObject::invokeMethod(filter, "reset");
+	// the sink lists belong to the filter thread
+	FrameNode* sources[] = { &source, &liveSource };
+	for (FrameNode* node : sources) {
+		QMetaObject::invokeMethod(node, "removeSink", Q_ARG(FrameNode*, activeFilter));
+		QMetaObject::invokeMethod(node, "addSink", Q_ARG(FrameNode*, filter));
+	}
+	activeFilter = filter;
 }
@@ -1,10 +1,14 @@
 #pragma once
+#include <QActionGroup>
 #include <QGraphicsScene>
 #include <QMainWindow>
 #include <QThread>
 
+#include "CacheRecounter.h"
+#include "ChunkedCounter.h"
 #include "GraphicsItemPolyline.h"
 #include "processing.h"
+#include "VideoRecorder.h"
 
 namespace Ui {
 	class MainWindow;
@@ -17,12 +21,39 @@ public:
 	explicit MainWindow(QWidget *parent = 0);
 	~MainWindow();
 	Q_SLOT void actionFileOpen();
+	Q_SLOT void actionCameraOpen();
+	Q_SLOT void liveStatistics(int droppedFrames, int latencyMs);
+	Q_SLOT void liveFailed();
+	Q_SLOT void actionFileCount();
+	Q_SLOT void actionRecord(bool enabled);
+	Q_SLOT void recordingFailed(const QString& filename);
+	Q_SLOT void actionSaveSnapshots(bool enabled);
+	Q_SLOT void actionRecordDetections(bool enabled);
+	Q_SLOT void actionRecountDetections();
+	Q_SLOT void actionLoadZones();
+	Q_SLOT void actionZoneStatistics();
+	Q_SLOT void actionSaveTrace();
+	Q_SLOT void setMode(QAction* action);
+	Q_SLOT void fileCounted(const QString& filename, const QVector<int>& carsCount);
 	Q_SLOT void setImage(const QImage& image);
 
 private:
+	static const int recountMinutes = 10;   // a changed line is recounted over this much past traffic
 	Ui::MainWindow *ui;
 	QThread filterThread;
-	DetectFilter filter;
+	VideoSource source;
+	LiveSource liveSource;
+	DayDetectFilter dayFilter;
+	CoarseToFineDetectFilter coarseFilter;
+	NightDetectFilter nightFilter;
+	QVector<DetectFilter*> filters;
+	DetectFilter* activeFilter;
+	DetectFilter* cacheFilter;  // records detections
+	QScopedPointer<SnapshotWriter> snapshots;   // shared by all filters
+	VideoRecorder recorder;
+	QThread batchThread;
+	ChunkedCounter batchCounter;
+	CacheRecounter cacheRecounter;
 	QScopedPointer<QGraphicsPixmapItem> pixmapItem;
 	QScopedPointer<GraphicsItemPolyline> polylineItem;
 
@@ -1,14 +1,18 @@
-#define SHOW_STEPS 0
-
 #include <algorithm>
+#include <cmath>
 #include <iterator>
+#include <limits>
+#include <set>
 #include <vector>
 #include "processing.h"
+#include "DetectionCache.h"
 
 CarDescriptor::CarDescriptor() :
 	isMatchFound(true),
 	isCounted(false),
-	numFramesWithoutMatch(0)
+	numFramesWithoutMatch(0),
+	lastSeenFrame(0),
+	zoneLabels(0)
 {
 	// empty
 }
@@ -18,7 +22,9 @@ CarDescriptor::CarDescriptor(const std::vector<cv::Point>& contour) :
 	boundingRect(cv::boundingRect(contour)),
 	isMatchFound(true),
 	isCounted(false),
-	numFramesWithoutMatch(0)
+	numFramesWithoutMatch(0),
+	lastSeenFrame(0),
+	zoneLabels(0)
 {
 	cv::Point center(
 		boundingRect.x + boundingRect.width / 2,
@@ -26,6 +32,7 @@ CarDescriptor::CarDescriptor(const std::vector<cv::Point>& contour) :
 	centerPositions.push_back(center);
 	diagonalSize = sqrt(pow(boundingRect.width, 2) + pow(boundingRect.height, 2));
 	aspectRatio = (double)boundingRect.width / boundingRect.height;
+	area = cv::contourArea(contour);
 }
 
 void CarDescriptor::predictNextPosition() {
@@ -47,12 +54,12 @@ void CarDescriptor::predictNextPosition() {
 	predictedNextPos.y = centerPositions.back().y + deltaY;
 }
 
-bool CarDescriptor::isCar() const {
-	return boundingRect.area() > 600 &&
+bool CarDescriptor::isCar(const DetectParams& params) const {
+	return boundingRect.area() > params.minArea &&
 		0.2 < aspectRatio && aspectRatio < 4.0 &&
-		boundingRect.width > 40 && boundingRect.height > 40 &&
-		diagonalSize > 70.0 &&
-		cv::contourArea(contour)/boundingRect.area() > 0.5;
+		boundingRect.width > params.minWidth && boundingRect.height > params.minHeight &&
+		diagonalSize > params.minDiagonal &&
+		area / boundingRect.area() > 0.5;
 }
 
 void CarDescriptor::assign(const CarDescriptor& other) {
@@ -61,6 +68,7 @@ void CarDescriptor::assign(const CarDescriptor& other) {
 	centerPositions.push_back(other.centerPositions.back());
 	diagonalSize = other.diagonalSize;
 	aspectRatio = other.aspectRatio;
+	area = other.area;
 	isMatchFound = true;
 }
 
@@ -77,7 +85,7 @@ double distance(const cv::Point& p1, const cv::Point& p2) {
 	return sqrt((double)(intX * intX + intY * intY));
 }
 
-void matchCars(std::list<CarDescriptor>& existing, const std::list<CarDescriptor>& current) {
+void matchCars(std::list<CarDescriptor>& existing, const std::list<CarDescriptor>& current, int maxFramesWithoutMatch, std::list<CarDescriptor>* expired) {
 	for (auto &ex : existing) {
 		ex.isMatchFound = false;
 		ex.predictNextPosition();
@@ -102,8 +110,11 @@ void matchCars(std::list<CarDescriptor>& existing, const std::list<CarDescriptor
 	}
 	for (auto it = existing.begin(); it != existing.end(); ) {
 		if (!it->isMatchFound) {
-			if (++it->numFramesWithoutMatch >= 5) {
-				it = existing.erase(it);
+			if (++it->numFramesWithoutMatch >= maxFramesWithoutMatch) {
+				if (expired)
+					expired->splice(expired->end(), existing, it++);
+				else
+					it = existing.erase(it);
 				continue;
 			}
 		}
@@ -111,7 +122,13 @@ void matchCars(std::list<CarDescriptor>& existing, const std::list<CarDescriptor
 	}
 }
 
-#ifdef SHOW_STEPS
+void retireTracks(DetectContext& ctx, std::list<CarDescriptor>& expired) {
+	for (auto &car : expired) {
+		ctx.zones.close(car, car.lastSeenFrame);
+		ctx.trajectories.add(car, ctx.frameCount);
+	}
+	ctx.trajectories.expire(ctx.frameCount);
+}
 
 void show(const cv::Size& imageSize, const std::vector<std::vector<cv::Point>>& contours, const std::string& title) {
 	cv::Mat image(imageSize, CV_8UC3, BLACK);
@@ -128,88 +145,271 @@ void show(const cv::Size& imageSize, const std::list<CarDescriptor>& cars, const
 	cv::imshow(title, image);
 }
 
-#endif
-
 inline void drawCarsInfo(const std::list<CarDescriptor>& cars, cv::Mat& image) {
 	for (auto car = cars.begin(); car != cars.end(); ++car)
 		cv::rectangle(image, car->boundingRect, RED, 2);
 }
 
-DetectFilter::DetectFilter(QObject* parent) :
-	AbstractFilter(parent),
-	_mutex(QMutex::Recursive),
-	_carsCount(0)
-{
-	_structuringElement = cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3));
-}
-
-bool DetectFilter::process(cv::Mat& currentFrame) {
-	_frameCount++;
-	cv::resize(currentFrame, currentFrame, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
-	if (_prevFrame.empty()) {
-		_prevFrame = currentFrame;
-		return true;
-	}
-	_currentFrameCars.resize(0);
-
-	cv::Mat prevFrameCopy, curFrameCopy, imgDifference, imgThresh;
-	cv::cvtColor(currentFrame, curFrameCopy, CV_BGR2GRAY);
-	cv::GaussianBlur(curFrameCopy, curFrameCopy, cv::Size(5,5), 0);
-	cv::cvtColor(_prevFrame, prevFrameCopy, CV_BGR2GRAY);
-	cv::GaussianBlur(prevFrameCopy, prevFrameCopy, cv::Size(5,5), 0);
-	cv::absdiff(prevFrameCopy, curFrameCopy, imgDifference);
-	cv::threshold(imgDifference, imgThresh, 15, 255.0, CV_THRESH_BINARY);
-	for (int i = 0; i < 3; i++) {
-		cv::dilate(imgThresh, imgThresh, _structuringElement);
-		cv::dilate(imgThresh, imgThresh, _structuringElement);
-		cv::erode(imgThresh, imgThresh, _structuringElement);
+
+
+// pipeline stages
+
+namespace {
+
+struct Headlight {
+	cv::Rect rect;
+	cv::Point2f center;
+	double area;
+};
+
+inline cv::Point rectCenter(const cv::Rect& rect) {
+	return cv::Point(rect.x + rect.width / 2, rect.y + rect.height / 2);
+}
+
+double distanceToSegment(const QLineF& line, const QPointF& p) {
+	QPointF d = line.p2() - line.p1();
+	double length2 = QPointF::dotProduct(d, d);
+	double t = length2 > 0 ? QPointF::dotProduct(p - line.p1(), d) / length2 : 0.0;
+	t = std::max(0.0, std::min(1.0, t));
+	return QLineF(p, line.p1() + d * t).length();
+}
+
+}
+
+void maskToTrack(const DetectContext& ctx, std::vector<cv::Point>& contour) {
+	if (ctx.maskToTrack == 1.0)
+		return;
+	for (auto &pt : contour) {
+		pt.x = cvRound(pt.x * ctx.maskToTrack);
+		pt.y = cvRound(pt.y * ctx.maskToTrack);
+	}
+}
+
+void NearLineRefinement::apply(DetectContext& ctx) {
+	// reference only, the source frame is never written to
+	cv::Mat prevSource = _prevSource;
+	_prevSource = ctx.source;
+	if (prevSource.empty() || prevSource.size() != ctx.source.size() || ctx.segments.empty())
+		return;
+
+	double scale = (double)ctx.source.cols / ctx.frame.cols;
+	// morphology on the coarse mask inflates blobs, search a bit around them
+	int margin = (int)std::ceil(2 * ctx.maskToTrack * scale);
+	// uncertainty of a coarse blob centre in tracking space: a coarse pixel
+	// grown by every dilation round
+	double maxShift = ctx.maskToTrack * (ctx.params.morphologyRounds + 1);
+	cv::Rect sourceRect(0, 0, ctx.source.cols, ctx.source.rows);
+	for (auto &car : ctx.cars) {
+		if (!car.isMatchFound)
+			continue;
+		const cv::Point center = car.centerPositions.back();
+		bool nearLine = false;
+		for (auto &line : ctx.segments) {
+			if (distanceToSegment(line, QPointF(center.x, center.y)) < car.diagonalSize) {
+				nearLine = true;
+				break;
+			}
+		}
+		if (!nearLine)
+			continue;
+
+		const cv::Rect &r = car.boundingRect;
+		cv::Rect roi = cv::Rect(
+			cvFloor(r.x * scale) - margin, cvFloor(r.y * scale) - margin,
+			cvCeil(r.width * scale) + 2 * margin, cvCeil(r.height * scale) + 2 * margin) & sourceRect;
+		if (roi.area() == 0)
+			continue;
+		cv::Mat current, previous, difference;
+		cv::cvtColor(ctx.source(roi), current, CV_BGR2GRAY);
+		cv::cvtColor(prevSource(roi), previous, CV_BGR2GRAY);
+		cv::absdiff(previous, current, difference);
+		cv::GaussianBlur(difference, difference, cv::Size(ctx.params.blurSize, ctx.params.blurSize), 0);
+		cv::threshold(difference, difference, ctx.params.threshold, 255.0, CV_THRESH_BINARY);
+		cv::dilate(difference, difference, cv::Mat(), cv::Point(-1, -1), 2);
+		std::vector<std::vector<cv::Point>> contours;
+		cv::findContours(difference, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+
+		// at full resolution a car falls apart into edges (front, rear,
+		// windows), so all moving regions inside the coarse blob make the car
+		if (contours.empty())
+			continue;
+		cv::Rect fine = cv::boundingRect(contours[0]);
+		for (size_t i = 1; i < contours.size(); ++i)
+			fine |= cv::boundingRect(contours[i]);
+		fine += roi.tl();
+		cv::Rect refined(
+			cvRound(fine.x / scale), cvRound(fine.y / scale),
+			std::max(1, cvRound(fine.width / scale)), std::max(1, cvRound(fine.height / scale)));
+		// anything further than the coarse blob could be off is another object
+		cv::Point refinedCenter = rectCenter(refined);
+		if (distance(refinedCenter, center) > maxShift)
+			continue;
+		car.boundingRect = refined;
+		car.centerPositions.back() = refinedCenter;
 	}
+}
+
+void HeadlightPairBlobs::detect(DetectContext& ctx) {
 	std::vector<std::vector<cv::Point>> contours;
-	cv::findContours(imgThresh, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_TC89_KCOS);
-#if SHOW_STEPS
-	show(imgThresh.size(), contours, "contours");
-#endif
-
-	std::vector<std::vector<cv::Point>> convexHulls(contours.size());
-	for (int i = 0; i < contours.size(); i++)
-		cv::convexHull(contours[i], convexHulls[i]);
-#if SHOW_STEPS
-	show(imgThresh.size(), convexHulls, "convexHulls");
-#endif
-
-	for (auto &convexHull : convexHulls) {
-		CarDescriptor car(convexHull);
-		if (car.isCar())
-			_currentFrameCars.push_back(car);
-	}
-#if SHOW_STEPS
-	show(imgThresh.size(), _currentFrameCars, "currentCars");
-#endif
-
-	if (_frameCount <= 2)
-		_cars.swap(_currentFrameCars);
-	else {
-		matchCars(_cars, _currentFrameCars);
-	}
-#if SHOW_STEPS
-	show(imgThresh.size(), _cars, "trackedCars");
-#endif
-
-	_prevFrame = currentFrame;
-	currentFrame = currentFrame.clone();
-
-	// prepare visualization
-	drawCarsInfo(_cars, currentFrame);
-
-	double fontScale = (currentFrame.rows * currentFrame.cols) / 1000000.0;
-	int fontThickness = (int)std::round(fontScale * 1.5);
+	cv::findContours(ctx.mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
 
-	// for each line
-	QMutexLocker lock(&_mutex);
-	for (int i = 0; i < _segments.size(); ++i) {
-		const QLineF &line = _segments[i];
-		bool highlight = false;
-		for (CarDescriptor &car : _cars) {
+	std::vector<Headlight> lights;
+	for (auto &contour : contours) {
+		double area = cv::contourArea(contour);
+		if (area < 4 || area > 1500)
+			continue;
+		cv::Rect rect = cv::boundingRect(contour);
+		double aspectRatio = (double)rect.width / rect.height;
+		if (aspectRatio < 0.3 || aspectRatio > 3.0)
+			continue;
+		lights.push_back(Headlight{ rect, cv::Point2f(rect.x + rect.width * 0.5f, rect.y + rect.height * 0.5f), area });
+	}
+	std::sort(lights.begin(), lights.end(), [](const Headlight& a, const Headlight& b) {
+		return a.center.x < b.center.x;
+	});
+
+	// Pair every light with the best partner to the right: same height in
+	// the frame, similar size, spaced by a few light widths.
+	ctx.currentFrameCars.clear();
+	std::vector<bool> used(lights.size(), false);
+	for (size_t i = 0; i < lights.size(); ++i) {
+		if (used[i])
+			continue;
+		const Headlight &a = lights[i];
+		int best = -1;
+		double bestScore = std::numeric_limits<double>::max();
+		for (size_t j = i + 1; j < lights.size(); ++j) {
+			const Headlight &b = lights[j];
+			double width = (a.rect.width + b.rect.width) * 0.5;
+			double dx = b.center.x - a.center.x;
+			if (dx > 10 * width)
+				break;
+			if (used[j] || dx < 2 * width)
+				continue;
+			double height = std::max(a.rect.height, b.rect.height);
+			double dy = std::abs(b.center.y - a.center.y);
+			double areaRatio = std::max(a.area, b.area) / std::min(a.area, b.area);
+			if (dy > height || areaRatio > 3.0)
+				continue;
+			double score = dy / height + areaRatio;
+			if (score < bestScore) {
+				bestScore = score;
+				best = (int)j;
+			}
+		}
+		if (best < 0)
+			continue;
+		const Headlight &b = lights[best];
+		used[i] = used[best] = true;
+		cv::Rect rect = a.rect | b.rect;
+		std::vector<cv::Point> contour{
+			rect.tl(), cv::Point(rect.br().x, rect.y), rect.br(), cv::Point(rect.x, rect.br().y)
+		};
+		maskToTrack(ctx, contour);
+		CarDescriptor car(contour);
+		car.flowPoints.push_back(a.center * ctx.maskToTrack);
+		car.flowPoints.push_back(b.center * ctx.maskToTrack);
+		ctx.currentFrameCars.push_back(car);
+	}
+}
+
+void FlowTracking::track(DetectContext& ctx) {
+	const cv::Size winSize(15, 15);
+	cv::Mat gray;
+	cv::cvtColor(ctx.frame, gray, CV_BGR2GRAY);
+	std::vector<cv::Mat> pyramid;
+	cv::buildOpticalFlowPyramid(gray, pyramid, winSize, maxLevel);
+
+	for (auto &car : ctx.cars)
+		car.isMatchFound = false;
+
+	// predict known cars by the mean shift of their surviving points; only a
+	// detection counts as a match, so tracks stuck on static lights expire
+	std::set<const CarDescriptor*> predicted;
+	std::vector<cv::Point2f> prevPoints, nextPoints;
+	for (auto &car : ctx.cars)
+		prevPoints.insert(prevPoints.end(), car.flowPoints.begin(), car.flowPoints.end());
+	if (!_prevPyramid.empty() && _prevPyramid[0].size() == pyramid[0].size() && !prevPoints.empty()) {
+		std::vector<uchar> status;
+		std::vector<float> error;
+		cv::calcOpticalFlowPyrLK(_prevPyramid, pyramid, prevPoints, nextPoints, status, error, winSize, maxLevel);
+		size_t k = 0;
+		for (auto &car : ctx.cars) {
+			cv::Point2f shift(0, 0);
+			std::vector<cv::Point2f> kept;
+			for (size_t i = 0; i < car.flowPoints.size(); ++i, ++k) {
+				if (status[k]) {
+					shift += nextPoints[k] - prevPoints[k];
+					kept.push_back(nextPoints[k]);
+				}
+			}
+			car.flowPoints.swap(kept);
+			if (car.flowPoints.empty())
+				continue;
+			shift *= 1.0f / car.flowPoints.size();
+			cv::Point offset(cvRound(shift.x), cvRound(shift.y));
+			car.boundingRect += offset;
+			for (auto &pt : car.contour)
+				pt += offset;
+			car.centerPositions.push_back(rectCenter(car.boundingRect));
+			predicted.insert(&car);
+		}
+	}
+
+	// refresh followed cars with detections, start new ones within the point budget
+	size_t points = 0;
+	for (auto &car : ctx.cars)
+		points += car.flowPoints.size();
+	for (auto &cur : ctx.currentFrameCars) {
+		auto nearest = ctx.cars.end();
+		double leastDistance = std::numeric_limits<double>::max();
+		for (auto it = ctx.cars.begin(); it != ctx.cars.end(); ++it) {
+			// one detection per car and frame
+			if (it->isMatchFound)
+				continue;
+			double v = distance(cur.centerPositions.back(), it->centerPositions.back());
+			if (v < leastDistance) {
+				leastDistance = v;
+				nearest = it;
+			}
+		}
+		if (leastDistance < cur.diagonalSize * 0.5) {
+			// the detection replaces the position estimated by the flow
+			if (predicted.count(&*nearest) && nearest->centerPositions.size() > 1)
+				nearest->centerPositions.pop_back();
+			points = points - nearest->flowPoints.size() + cur.flowPoints.size();
+			nearest->assign(cur);
+			nearest->flowPoints = cur.flowPoints;
+			nearest->numFramesWithoutMatch = 0;
+		}
+		else if (points + cur.flowPoints.size() <= (size_t)maxPoints) {
+			points += cur.flowPoints.size();
+			ctx.cars.push_back(cur);
+		}
+	}
+
+	std::list<CarDescriptor> expired;
+	for (auto it = ctx.cars.begin(); it != ctx.cars.end(); ) {
+		if (it->isMatchFound)
+			it->lastSeenFrame = ctx.frameCount;
+		else {
+			if (++it->numFramesWithoutMatch >= ctx.params.maxFramesWithoutMatch) {
+				expired.splice(expired.end(), ctx.cars, it++);
+				continue;
+			}
+		}
+		++it;
+	}
+	retireTracks(ctx, expired);
+	_prevPyramid.swap(pyramid);
+}
+
+void LineCounting::apply(DetectContext& ctx) {
+	ctx.highlight.fill(false, ctx.segments.size());
+	ctx.crossings.clear();
+	for (int i = 0; i < ctx.segments.size(); ++i) {
+		const QLineF &line = ctx.segments[i];
+		for (CarDescriptor &car : ctx.cars) {
 			if (!car.isCounted && car.centerPositions.size() >= 2) {
 				bool directionDown;
 				const cv::Point
@@ -217,17 +417,123 @@ bool DetectFilter::process(cv::Mat& currentFrame) {
 					&q2 = car.centerPositions[(int)car.centerPositions.size() - 1];
 				if (intersects(line, QLineF(p2.x, p2.y, q2.x, q2.y), directionDown)) {
 					if (directionDown) {
-						++_carsCount[i];
-						highlight = true;
+						++ctx.carsCount[i];
+						ctx.highlight[i] = true;
 						car.isCounted = true;
+						ctx.crossings.push_back(CrossingEvent{ ctx.frameCount, i, car.boundingRect });
 					}
 				}
 			}
 		}
+	}
+}
+
+void DrawOverlay::apply(DetectContext& ctx) {
+	cv::Mat &image = ctx.frame;
+	drawCarsInfo(ctx.cars, image);
+
+	double fontScale = (image.rows * image.cols) / 1000000.0;
+	int fontThickness = (int)std::round(fontScale * 1.5);
+
+	for (int i = 0; i < ctx.segments.size(); ++i) {
+		const QLineF &line = ctx.segments[i];
+		bool highlight = i < ctx.highlight.size() && ctx.highlight[i];
 		QPointF center = line.center();
-		cv::line(currentFrame, cv::Point((int)line.x1(), (int)line.y1()), cv::Point((int)line.x2(), (int)line.y2()), highlight ? GREEN : RED, 2);
-		cv::putText(currentFrame, std::to_string(_carsCount[i]), cv::Point((int)center.x(), (int)center.y()), CV_FONT_HERSHEY_SIMPLEX, fontScale, YELLOW, fontThickness);
+		cv::line(image, cv::Point((int)line.x1(), (int)line.y1()), cv::Point((int)line.x2(), (int)line.y2()), highlight ? GREEN : RED, 2);
+		cv::putText(image, std::to_string(ctx.carsCount[i]), cv::Point((int)center.x(), (int)center.y()), CV_FONT_HERSHEY_SIMPLEX, fontScale, YELLOW, fontThickness);
+	}
+
+	// zones with their current occupancy and mean dwell time in frames
+	const QVector<QPolygonF> &zones = ctx.zones.zones();
+	for (int i = 0; i < zones.size() && i < ctx.zones.stats().size(); ++i) {
+		std::vector<cv::Point> polygon;
+		for (auto &pt : zones[i])
+			polygon.push_back(cv::Point((int)pt.x(), (int)pt.y()));
+		cv::polylines(image, polygon, true, WHITE, 1);
+		QPointF center = zones[i].boundingRect().center();
+		const ZoneStats &stats = ctx.zones.stats()[i];
+		std::string text = std::to_string(stats.occupancy) + " / " + std::to_string(qRound(stats.meanDwellFrames()));
+		cv::putText(image, text, cv::Point((int)center.x(), (int)center.y()), CV_FONT_HERSHEY_SIMPLEX, fontScale, WHITE, fontThickness);
+	}
+}
+
+
+
+DetectFilter::DetectFilter(QObject* parent) :
+	AbstractFilter(parent),
+	_mutex(QMutex::Recursive),
+	_snapshots(nullptr)
+{
+	// empty
+}
+
+void DetectFilter::setSegments(const QVector<QLineF>& segments) {
+	QMutexLocker lock(&_mutex);
+	if (!_ctx.trajectories.isEnabled()) {
+		_ctx.segments = segments;
+		_ctx.carsCount.resize(_ctx.segments.size());
+		return;
+	}
+	// segments that kept their geometry keep their running counts
+	QVector<int> carsCount(segments.size());
+	QVector<bool> changed(segments.size(), true);
+	for (int i = 0; i < segments.size(); ++i) {
+		int j = _ctx.segments.indexOf(segments[i]);
+		if (j >= 0 && j < _ctx.carsCount.size()) {
+			carsCount[i] = _ctx.carsCount[j];
+			changed[i] = false;
+		}
+	}
+	// moved or new ones start from their count over the recent trajectories
+	if (changed.contains(true)) {
+		QVector<int> recounted = _ctx.trajectories.recount(segments, _ctx.cars, _ctx.frameCount);
+		for (int i = 0; i < segments.size(); ++i)
+			if (changed[i])
+				carsCount[i] = recounted[i];
+	}
+	_ctx.segments = segments;
+	_ctx.carsCount = carsCount;
+}
+
+DetectFilter::~DetectFilter() {
+	// out of line, the cache writer is incomplete in the header
+}
+
+void DetectFilter::setDetectionCache(const QString& filename) {
+	QMutexLocker lock(&_mutex);
+	_cacheWriter.reset(filename.isEmpty() ? nullptr : new DetectionCacheWriter(filename));
+	_ctx.cacheWriter = _cacheWriter.data();
+}
+
+void DetectFilter::reset() {
+	QMutexLocker lock(&_mutex);
+	// visits in progress end where the cars were last seen
+	for (auto &car : _ctx.cars)
+		_ctx.zones.close(car, car.lastSeenFrame);
+	_ctx.cars.clear();
+	_ctx.currentFrameCars.clear();
+	_ctx.highlight.clear();
+	_ctx.crossings.clear();
+	_ctx.trajectories.clear();
+	resetPipeline();
+	if (_cacheWriter)
+		_cacheWriter->markReset();
+}
+
+void DetectFilter::setSnapshotWriter(SnapshotWriter* writer) {
+	QMutexLocker lock(&_mutex);
+	_snapshots = writer;
+}
+
+void DetectFilter::saveSnapshots(const SharedFrame& source) {
+	if (!_snapshots || _ctx.crossings.empty() || _ctx.frame.empty())
+		return;
+	// bounding rects are in detection scale, the crop comes from the source frame
+	double sx = (double)source.mat().cols / _ctx.frame.cols;
+	double sy = (double)source.mat().rows / _ctx.frame.rows;
+	for (auto &crossing : _ctx.crossings) {
+		const cv::Rect &r = crossing.boundingRect;
+		cv::Rect rect(cvFloor(r.x * sx), cvFloor(r.y * sy), cvCeil(r.width * sx), cvCeil(r.height * sy));
+		_snapshots->enqueue(source, rect, crossing.segment);
 	}
-	//cv::resize(result, result, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
-	return true;
 }
@@ -7,10 +7,44 @@
 #include <QObject>
 #include <QTimerEvent>
 #include <list>
+#include <string>
 #include <vector>
 #include <opencv2/opencv.hpp>
 
 #include "QtUtility.h"
+#include "SnapshotWriter.h"
+#include "Tracer.h"
+#include "TrajectoryStore.h"
+#include "ZoneMap.h"
+
+// Switch to 1 to show intermediate steps of the algorithm in separate windows
+#ifndef SHOW_STEPS
+#	define SHOW_STEPS 0
+#endif
+
+// Tunable constants of the detector
+struct DetectParams {
+	double threshold;           // frame difference threshold
+	int blurSize;               // Gaussian kernel, odd
+	int morphologyRounds;       // dilate-dilate-erode rounds
+	int minArea;                // car size gates, in segment coordinates
+	int minWidth;
+	int minHeight;
+	double minDiagonal;
+	int maxFramesWithoutMatch;  // a track is dropped after that many misses
+	DetectParams() :
+		threshold(15),
+		blurSize(5),
+		morphologyRounds(3),
+		minArea(600),
+		minWidth(40),
+		minHeight(40),
+		minDiagonal(70.0),
+		maxFramesWithoutMatch(5)
+	{
+		// empty
+	}
+};
 
 struct CarDescriptor {
 	std::vector<cv::Point> contour;
@@ -18,43 +52,526 @@ struct CarDescriptor {
 	std::vector<cv::Point> centerPositions;
 	double diagonalSize;
 	double aspectRatio;
+	double area;                // of the contour
 	bool isMatchFound;
 	bool isCounted;
 	int numFramesWithoutMatch;
+	int lastSeenFrame;          // last frame a detection matched the track
 	cv::Point predictedNextPos;
+	std::vector<cv::Point2f> flowPoints;    // night mode: points followed by optical flow
+	quint32 zoneLabels;                     // zones the car is in, see ZoneMap
+	std::vector<std::pair<int, int>> zoneEntries;   // zone, frame of entering
 	CarDescriptor();
 	CarDescriptor(const std::vector<cv::Point>& contour);
 	void predictNextPosition(void);
-	bool isCar() const;
+	bool isCar(const DetectParams& params) const;
 	void assign(const CarDescriptor& other);
 };
 
+// Tracks lost for maxFramesWithoutMatch frames are moved to expired when given
+void matchCars(std::list<CarDescriptor>& existing, const std::list<CarDescriptor>& current, int maxFramesWithoutMatch, std::list<CarDescriptor>* expired = nullptr);
+
+void show(const cv::Size& imageSize, const std::vector<std::vector<cv::Point>>& contours, const std::string& title);
+void show(const cv::Size& imageSize, const std::list<CarDescriptor>& cars, const std::string& title);
+
+
+
+// Detection pipeline
+//
+// Every step of the algorithm is a policy type with a non-virtual apply().
+// DetectPipeline glues the policies together at compile time, so each
+// combination is inlined into a single specialized process() without
+// virtual calls or runtime switches between the steps.
+
+// Car counted on a segment
+struct CrossingEvent {
+	int frame;
+	int segment;
+	cv::Rect boundingRect;
+};
+
+class DetectionCache;
+class DetectionCacheWriter;
+
+// State of a single stream passed between the pipeline stages.
+//
+// Cars are tracked and counted in the space of the segments, which is the
+// source frame scaled by 0.5 (ctx.frame). Detection may run at a coarser
+// scale, maskToTrack converts its coordinates into the tracking space.
+struct DetectContext {
+	int frameCount;             // number of the current frame, 1-based
+	DetectParams params;
+	cv::Mat source;             // full-resolution frame, read-only
+	cv::Mat frame;              // current frame at tracking scale, annotated by the overlay
+	cv::Mat detectFrame;        // frame the foreground is computed on
+	double maskToTrack;
+	cv::Mat mask;               // binary foreground mask at detection scale
+	std::list<CarDescriptor> cars, currentFrameCars;
+	QVector<QLineF> segments;
+	QVector<int> carsCount;
+	QVector<bool> highlight;    // segments crossed on the current frame
+	std::vector<CrossingEvent> crossings;   // counted on the current frame
+	ZoneMap zones;
+	TrajectoryStore trajectories;           // finished tracks kept for recounting
+	DetectionCacheWriter* cacheWriter;      // detections are recorded when set
+	const DetectionCache* cacheReader;      // source of CachedBlobs
+	DetectContext() : frameCount(0), maskToTrack(1.0), cacheWriter(nullptr), cacheReader(nullptr) { }
+};
+
+// Converts a contour found on the mask into the tracking space
+void maskToTrack(const DetectContext& ctx, std::vector<cv::Point>& contour);
+
+// Detection cache hooks, see DetectionCache.h
+void recordDetections(DetectContext& ctx);
+void recordSkippedFrame(DetectContext& ctx);
+void loadDetections(DetectContext& ctx);
+bool isCachedFrameSkipped(const DetectContext& ctx);
+
+// Tracks that ended on the current frame close their zone visits and are
+// handed over to ctx.trajectories, which drops the ones that left its
+// window; called on every tracked frame
+void retireTracks(DetectContext& ctx, std::list<CarDescriptor>& expired);
+
+// Debug taps compile to nothing unless Enabled is set
+template <bool Enabled>
+struct DebugTap {
+	template <class T>
+	void operator()(const cv::Size& imageSize, const T& items, const char* title) const {
+		if (Enabled)
+			show(imageSize, items, title);
+	}
+};
+
+// preprocess
+
+struct HalfScale {
+	void apply(DetectContext& ctx, const cv::Mat& frame) {
+		// always a fresh buffer: the previous one may still be shown by the GUI
+		cv::Mat scaled;
+		cv::resize(frame, scaled, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
+		ctx.source = frame;
+		ctx.frame = scaled;
+		ctx.detectFrame = scaled;
+		ctx.maskToTrack = 1.0;
+	}
+};
+
+// Input already scaled by 0.5, e.g. decoded once and shared by several
+// pipelines. The frame is only read, so it cannot be combined with an overlay.
+struct Prescaled {
+	void apply(DetectContext& ctx, const cv::Mat& frame) {
+		ctx.source = frame;
+		ctx.frame = frame;
+		ctx.detectFrame = frame;
+		ctx.maskToTrack = 1.0;
+	}
+};
+
+// Motion search on a quarter of the source resolution, 1/16 of its pixels.
+// Only the foreground and morphology stages run at that size: the frame is
+// still scaled to half resolution for tracking, the overlay and the output.
+struct CoarseScale {
+	void apply(DetectContext& ctx, const cv::Mat& frame) {
+		cv::Mat scaled, coarse;
+		cv::resize(frame, scaled, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
+		cv::resize(scaled, coarse, cv::Size(), 0.5, 0.5, cv::INTER_AREA);
+		ctx.source = frame;
+		ctx.frame = scaled;
+		ctx.detectFrame = coarse;
+		ctx.maskToTrack = 2.0;
+	}
+};
+
+// foreground; apply() returns false while the model is not ready yet
+
+struct FrameDifference {
+	bool apply(DetectContext& ctx) {
+		cv::Mat gray, difference;
+		cv::cvtColor(ctx.detectFrame, gray, CV_BGR2GRAY);
+		cv::GaussianBlur(gray, gray, cv::Size(ctx.params.blurSize, ctx.params.blurSize), 0);
+		// first frame, or the stream was switched to another resolution
+		if (_prevGray.size() != gray.size()) {
+			_prevGray = gray;
+			return false;
+		}
+		cv::absdiff(_prevGray, gray, difference);
+		cv::threshold(difference, ctx.mask, ctx.params.threshold, 255.0, CV_THRESH_BINARY);
+		// blurred luminance is all that is needed from the previous frame
+		_prevGray = gray;
+		return true;
+	}
+private:
+	cv::Mat _prevGray;
+};
+
+struct BackgroundModel {
+	BackgroundModel() : _model(cv::createBackgroundSubtractorMOG2()) { }
+	bool apply(DetectContext& ctx) {
+		_model->apply(ctx.detectFrame, ctx.mask);
+		// drop shadows (marked as 127 by MOG2)
+		cv::threshold(ctx.mask, ctx.mask, 200, 255.0, CV_THRESH_BINARY);
+		return true;
+	}
+private:
+	cv::Ptr<cv::BackgroundSubtractorMOG2> _model;
+};
+
+// morphology
+
+struct DilateErode {
+	DilateErode() : _structuringElement(cv::getStructuringElement(cv::MORPH_RECT, cv::Size(3, 3))) { }
+	void apply(DetectContext& ctx) {
+		for (int i = 0; i < ctx.params.morphologyRounds; i++) {
+			cv::dilate(ctx.mask, ctx.mask, _structuringElement);
+			cv::dilate(ctx.mask, ctx.mask, _structuringElement);
+			cv::erode(ctx.mask, ctx.mask, _structuringElement);
+		}
+	}
+private:
+	cv::Mat _structuringElement;
+};
+
+// blobs
+
+struct ConvexHullBlobs {
+	template <class Tap>
+	void apply(DetectContext& ctx, const Tap& tap) {
+		std::vector<std::vector<cv::Point>> contours;
+		cv::findContours(ctx.mask, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_TC89_KCOS);
+		tap(ctx.mask.size(), contours, "contours");
+
+		std::vector<std::vector<cv::Point>> convexHulls(contours.size());
+		for (size_t i = 0; i < contours.size(); i++)
+			cv::convexHull(contours[i], convexHulls[i]);
+		tap(ctx.mask.size(), convexHulls, "convexHulls");
+
+		ctx.currentFrameCars.clear();
+		for (auto &convexHull : convexHulls) {
+			maskToTrack(ctx, convexHull);
+			CarDescriptor car(convexHull);
+			if (car.isCar(ctx.params))
+				ctx.currentFrameCars.push_back(car);
+		}
+		tap(ctx.frame.size(), ctx.currentFrameCars, "currentCars");
+	}
+};
+
+// Records frames the wrapped foreground stage is not ready on, so the
+// replay skips tracking on them as well
+template <class Foreground>
+struct RecordedForeground : Foreground {
+	bool apply(DetectContext& ctx) {
+		bool ready = Foreground::apply(ctx);
+		if (!ready && ctx.cacheWriter)
+			recordSkippedFrame(ctx);
+		return ready;
+	}
+};
+
+// Records the detections of the wrapped stage to ctx.cacheWriter
+template <class Blobs>
+struct RecordedBlobs : Blobs {
+	template <class Tap>
+	void apply(DetectContext& ctx, const Tap& tap) {
+		Blobs::apply(ctx, tap);
+		if (ctx.cacheWriter)
+			recordDetections(ctx);
+	}
+};
+
+// Replays detections from ctx.cacheReader instead of computing them. Used
+// with the No* stages below, only tracking and counting are run again.
+struct CachedBlobs {
+	template <class Tap>
+	void apply(DetectContext& ctx, const Tap&) {
+		loadDetections(ctx);
+	}
+};
+
+// Not ready on the frames that were skipped when recording
+struct CachedForeground {
+	bool apply(DetectContext& ctx) { return !isCachedFrameSkipped(ctx); }
+};
+
+struct NoPreprocess {
+	void apply(DetectContext&, const cv::Mat&) { }
+};
+
+struct NoMorphology {
+	void apply(DetectContext&) { }
+};
+
+// tracking
+
+struct PredictiveTracking {
+	template <class Tap>
+	void apply(DetectContext& ctx, const Tap& tap) {
+		std::list<CarDescriptor> expired;
+		if (ctx.cars.empty())
+			ctx.cars.swap(ctx.currentFrameCars);
+		else
+			matchCars(ctx.cars, ctx.currentFrameCars, ctx.params.maxFramesWithoutMatch, &expired);
+		for (auto &car : ctx.cars)
+			if (car.isMatchFound)
+				car.lastSeenFrame = ctx.frameCount;
+		retireTracks(ctx, expired);
+		tap(ctx.frame.size(), ctx.cars, "trackedCars");
+	}
+};
+
+// night mode
+//
+// Cars are found as pairs of bright headlight blobs and then followed with
+// pyramidal Lucas-Kanade flow on a few points per car (the headlight
+// centres), so per-frame cost is bounded by maxPoints.
+
+struct HeadlightMask {
+	bool apply(DetectContext& ctx) {
+		cv::Mat gray;
+		cv::cvtColor(ctx.detectFrame, gray, CV_BGR2GRAY);
+		cv::threshold(gray, ctx.mask, 220, 255.0, CV_THRESH_BINARY);
+		return true;
+	}
+};
+
+struct Dilate {
+	Dilate() : _structuringElement(cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(3, 3))) { }
+	void apply(DetectContext& ctx) {
+		cv::dilate(ctx.mask, ctx.mask, _structuringElement);
+	}
+private:
+	cv::Mat _structuringElement;
+};
+
+struct HeadlightPairBlobs {
+	template <class Tap>
+	void apply(DetectContext& ctx, const Tap& tap) {
+		detect(ctx);
+		tap(ctx.frame.size(), ctx.currentFrameCars, "headlightPairs");
+	}
+	void detect(DetectContext& ctx);
+};
+
+struct FlowTracking {
+	static const int maxPoints = 256;
+	static const int maxLevel = 2;
+	template <class Tap>
+	void apply(DetectContext& ctx, const Tap& tap) {
+		track(ctx);
+		tap(ctx.frame.size(), ctx.cars, "trackedCars");
+	}
+	void track(DetectContext& ctx);
+private:
+	std::vector<cv::Mat> _prevPyramid;
+};
+
+// refinement
+
+struct NoRefinement {
+	void apply(DetectContext&) { }
+};
+
+// Re-measures the cars approaching a segment on the full-resolution frame,
+// where the crossing position decides the count. Everything else keeps the
+// coarse measurement.
+struct NearLineRefinement {
+	void apply(DetectContext& ctx);
+private:
+	cv::Mat _prevSource;
+};
+
+// counting
+
+struct LineCounting {
+	void apply(DetectContext& ctx);
+};
+
+// zones
+
+struct ZoneOccupancy {
+	void apply(DetectContext& ctx) {
+		if (!ctx.zones.isEmpty())
+			ctx.zones.update(ctx.cars, ctx.frameCount, ctx.frame.size());
+	}
+};
+
+struct NoZones {
+	void apply(DetectContext&) { }
+};
+
+// overlay
+
+struct DrawOverlay {
+	void apply(DetectContext& ctx);
+};
+
+struct NoOverlay {
+	void apply(DetectContext&) { }
+};
+
+template <
+	class Preprocess,
+	class Foreground,
+	class Morphology,
+	class Blobs,
+	class Tracking,
+	class Refinement,
+	class Counting,
+	class Zones,
+	class Overlay,
+	class Tap = DebugTap<SHOW_STEPS>
+>
+class DetectPipeline {
+public:
+	// The source frame is only read; the result is left in ctx.frame
+	bool run(DetectContext& ctx, const cv::Mat& frame) {
+		++ctx.frameCount;
+		{
+			TRACE_SCOPE("preprocess");
+			_preprocess.apply(ctx, frame);
+		}
+		bool ready;
+		{
+			TRACE_SCOPE("foreground");
+			ready = _foreground.apply(ctx);
+		}
+		if (ready) {
+			{
+				TRACE_SCOPE("morphology");
+				_morphology.apply(ctx);
+			}
+			{
+				TRACE_SCOPE("blobs");
+				_blobs.apply(ctx, _tap);
+			}
+			{
+				TRACE_SCOPE("tracking");
+				_tracking.apply(ctx, _tap);
+			}
+			{
+				TRACE_SCOPE("refinement");
+				_refinement.apply(ctx);
+			}
+			{
+				TRACE_SCOPE("counting");
+				_counting.apply(ctx);
+			}
+			{
+				TRACE_SCOPE("zones");
+				_zones.apply(ctx);
+			}
+			{
+				TRACE_SCOPE("overlay");
+				_overlay.apply(ctx);
+			}
+		}
+		return true;
+	}
+
+private:
+	Preprocess _preprocess;
+	Foreground _foreground;
+	Morphology _morphology;
+	Blobs _blobs;
+	Tracking _tracking;
+	Refinement _refinement;
+	Counting _counting;
+	Zones _zones;
+	Overlay _overlay;
+	Tap _tap;
+};
+
+typedef DetectPipeline<HalfScale, RecordedForeground<FrameDifference>, DilateErode, RecordedBlobs<ConvexHullBlobs>, PredictiveTracking, NoRefinement, LineCounting, ZoneOccupancy, DrawOverlay> DayPipeline;
+typedef DetectPipeline<HalfScale, FrameDifference, DilateErode, ConvexHullBlobs, PredictiveTracking, NoRefinement, LineCounting, NoZones, NoOverlay> DayBatchPipeline;
+typedef DetectPipeline<Prescaled, FrameDifference, DilateErode, ConvexHullBlobs, PredictiveTracking, NoRefinement, LineCounting, NoZones, NoOverlay> SweepPipeline;
+typedef DetectPipeline<CoarseScale, RecordedForeground<FrameDifference>, DilateErode, RecordedBlobs<ConvexHullBlobs>, PredictiveTracking, NearLineRefinement, LineCounting, ZoneOccupancy, DrawOverlay> CoarseToFinePipeline;
+typedef DetectPipeline<HalfScale, HeadlightMask, Dilate, HeadlightPairBlobs, FlowTracking, NoRefinement, LineCounting, ZoneOccupancy, DrawOverlay> NightPipeline;
+typedef DetectPipeline<NoPreprocess, CachedForeground, NoMorphology, CachedBlobs, PredictiveTracking, NoRefinement, LineCounting, NoZones, NoOverlay> ReplayPipeline;
+
+
+
 class DetectFilter : public AbstractFilter {
 	Q_OBJECT
 	Q_PROPERTY(QVector<QLineF> segments READ segments WRITE setSegments)
 
 public:
 	explicit DetectFilter(QObject* parent = nullptr);
+	~DetectFilter();
 
 	QVector<QLineF> segments() const {
 		QMutexLocker lock(&_mutex);
-		return _segments;
+		return _ctx.segments;
+	}
+	Q_SLOT void setSegments(const QVector<QLineF>& segments);
+	// Finished tracks of the last `frames` frames are kept, so that moved or
+	// new segments start from their count over that window; 0 disables
+	Q_SLOT void setRecountWindow(int frames) {
+		QMutexLocker lock(&_mutex);
+		_ctx.trajectories.setWindow(frames);
 	}
-	Q_SLOT void setSegments(const QVector<QLineF>& segments) {
+	Q_SLOT void setZones(const QVector<QPolygonF>& zones) {
 		QMutexLocker lock(&_mutex);
-		_segments = segments;
-		_carsCount.resize(_segments.size());
+		_ctx.zones.setZones(zones);
+		// visits in progress refer to the old zones
+		for (auto &car : _ctx.cars) {
+			car.zoneLabels = 0;
+			car.zoneEntries.clear();
+		}
 	}
+	QVector<ZoneStats> zoneStats() const {
+		QMutexLocker lock(&_mutex);
+		return _ctx.zones.stats();
+	}
+	// Crops of counted cars are saved by the writer, which is not owned and
+	// may be shared by several filters; nullptr disables. The writer is not
+	// used any more once this returns.
+	void setSnapshotWriter(SnapshotWriter* writer);
+	// Detections are recorded to the cache file, empty string disables
+	Q_SLOT void setDetectionCache(const QString& filename);
+	// Forgets the previous stream: tracks, stored trajectories and the frames
+	// the stages keep. Counts and settings stay. Call before the filter gets
+	// frames from another source or after it was detached for a while.
+	Q_SLOT void reset();
 
 protected:
-	 bool process(cv::Mat& mat) override;
-
-private:
 	mutable QMutex _mutex;
-	QVector<QLineF> _segments;
-	QVector<int> _carsCount;
+	DetectContext _ctx;
+	SnapshotWriter* _snapshots;
+	QScopedPointer<DetectionCacheWriter> _cacheWriter;
 
-	std::list<CarDescriptor> _cars, _currentFrameCars;
-	cv::Mat _prevFrame;
-	cv::Mat _structuringElement;
+	void saveSnapshots(const SharedFrame& source);
+	virtual void resetPipeline() { }
+};
+
+// Binds a compile-time pipeline to DetectFilter. Templates cannot carry
+// Q_OBJECT, so signals and slots are declared by the base class.
+template <class Pipeline>
+class PipelineFilter : public DetectFilter {
+public:
+	explicit PipelineFilter(QObject* parent = nullptr) :
+		DetectFilter(parent)
+	{
+		// empty
+	}
+
+protected:
+	bool process(SharedFrame& frame) override {
+		// setSegments is delivered on the filter thread, so the lock is uncontended
+		QMutexLocker lock(&_mutex);
+		if (!_pipeline.run(_ctx, frame.mat()))
+			return false;
+		saveSnapshots(frame);
+		frame.reset(_ctx.frame);
+		return true;
+	}
+	void resetPipeline() override {
+		_pipeline = Pipeline();
+	}
+
+private:
+	Pipeline _pipeline;
 };
+
+typedef PipelineFilter<DayPipeline> DayDetectFilter;
+typedef PipelineFilter<CoarseToFinePipeline> CoarseToFineDetectFilter;
+typedef PipelineFilter<NightPipeline> NightDetectFilter;